@@ -0,0 +1,1086 @@
+#ifndef ESET_ART_HPP
+#define ESET_ART_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if __cplusplus > 201703L
+#include <compare>
+#endif
+
+#ifdef DEBUG
+#include <iostream>
+#endif
+
+#include "../common/eset_common.hpp"
+
+namespace eset::art {
+
+// Keys the radix tree can hold: integers and std::string, ordered by std::less.
+template <class Key, class Compare>
+struct Applies : std::integral_constant<bool,
+    (std::is_integral<Key>::value && !std::is_same<Key, bool>::value && sizeof(Key) <= 8
+        && (std::is_same<Compare, std::less<Key>>::value || std::is_same<Compare, std::less<>>::value))
+    || (std::is_same<Key, std::string>::value
+        && (std::is_same<Compare, std::less<std::string>>::value || std::is_same<Compare, std::less<>>::value))> {};
+
+/*
+The bytes of a key, such that comparing them as unsigned strings orders the
+keys: integers big-endian with the sign bit flipped, strings as they are
+(std::string compares its chars as unsigned char too).
+*/
+template <class Key, bool = std::is_integral<Key>::value>
+class Bytes {
+private:
+    unsigned char buf[sizeof(Key)];
+
+public:
+    explicit Bytes(Key key) {
+        typedef std::make_unsigned_t<Key> U;
+        U u = U(key);
+        if (std::is_signed<Key>::value) u ^= U(U(1) << (sizeof(Key) * 8 - 1));
+        for (size_t i = sizeof(Key); i--; u = U(u >> 4 >> 4)) buf[i] = (unsigned char)u;
+    }
+
+    size_t size() const {
+        return sizeof(Key);
+    }
+
+    unsigned char operator[](size_t i) const {
+        return buf[i];
+    }
+};
+
+template <class Key>
+class Bytes<Key, false> {
+private:
+    std::string_view s;
+
+public:
+    explicit Bytes(std::string_view s) : s{s} {}
+
+    size_t size() const {
+        return s.size();
+    }
+
+    unsigned char operator[](size_t i) const {
+        return (unsigned char)s[i];
+    }
+};
+
+/*
+Adaptive radix tree (Leis et al., ICDE 2013): a trie on the bytes of the
+keys whose nodes grow and shrink between four layouts as children come and
+go, 4 and 16 children in sorted arrays (the 16 searched with one SSE2
+compare), 48 through a 256-byte index and 256 as a direct array. A search
+reads one node per key byte at most, however many keys there are, and far
+fewer in practice: a node whose keys all share some bytes stores them as a
+prefix and skips them (path compression), and a subtree of one key is just
+that key (lazy expansion). Dense integers are the best case, one node per
+byte that actually varies.
+
+Each node counts the keys below it, so rank, nth and range take one descent.
+Keys live in leaves that are linked in order for O(1) iteration and never
+move, so iterators and references stay valid until their key is erased. A
+string key that is a prefix of others is held by the node where it ends.
+*/
+template <class Key, class Compare = std::less<Key>>
+class ESet {
+    static_assert(Applies<Key, Compare>::value, "eset::art::ESet takes integer or std::string keys ordered by std::less");
+
+private:
+    struct Leaf {
+        Leaf *prev, *next;
+        Key key;
+    };
+
+    // Prefix bytes stored in the node; longer prefixes read the rest from a key below.
+    static constexpr size_t PREFIX = 8;
+
+    enum { NODE4, NODE16, NODE48, NODE256 };
+
+    struct Node {
+        unsigned char type;
+        unsigned short count;   // children, not counting term
+        unsigned int plen;
+        unsigned char prefix[PREFIX];
+        size_t size;            // keys below
+        Leaf *term;             // the key that ends at this node, if any
+    };
+
+    struct Node4 : Node {
+        unsigned char keys[4];
+        Node *child[4];
+    };
+
+    struct Node16 : Node {
+        unsigned char keys[16];
+        Node *child[16];
+    };
+
+    struct Node48 : Node {
+        unsigned char index[256];   // slot + 1, or 0 for none
+        Node *child[48];
+    };
+
+    struct Node256 : Node {
+        Node *child[256];
+    };
+
+    typedef art::Bytes<Key> Bytes;
+
+    // Whether a K can be looked up as is: through the comparator, and with bytes of its own.
+    template <class K>
+    struct Looks : std::integral_constant<bool, ESetLookup<Compare, Key, K>::value
+        && (std::is_same<K, Key>::value || (std::is_same<Key, std::string>::value && std::is_convertible<const K&, std::string_view>::value))> {};
+
+    template <class K>
+    using Lookup = std::enable_if_t<Looks<K>::value>;
+
+    // ESetEmplaceLookup, narrowed down to what Looks takes.
+    template <class... Args>
+    struct EmplaceLookup : std::false_type {};
+
+    template <class Arg>
+    struct EmplaceLookup<Arg> : std::integral_constant<bool, ESetEmplaceLookup<Compare, Key, Arg>::value && Looks<std::decay_t<Arg>>::value> {};
+
+    // A child slot holds either a node or, with the low bit set, a leaf.
+    Node *root;
+    Leaf *head, *tail;
+
+    static bool isLeaf(const Node *p) {
+        return reinterpret_cast<std::uintptr_t>(p) & 1;
+    }
+
+    static Leaf* leafOf(const Node *p) {
+        return reinterpret_cast<Leaf*>(reinterpret_cast<std::uintptr_t>(p) - 1);
+    }
+
+    static Node* tag(Leaf *leaf) {
+        return reinterpret_cast<Node*>(reinterpret_cast<std::uintptr_t>(leaf) + 1);
+    }
+
+    static size_t sizeOf(const Node *p) {
+        return isLeaf(p) ? 1 : p->size;
+    }
+
+    // Negative, zero or positive as a is before, equal to or after b.
+    static int compare(const Bytes &a, const Bytes &b) {
+        ESET_COUNT(compares);
+        size_t n = std::min(a.size(), b.size());
+        for (size_t i = 0; i < n; i++) {
+            if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+        }
+        return a.size() < b.size() ? -1 : a.size() > b.size();
+    }
+
+    static Node** findChild(Node *p, unsigned char c) {
+        switch (p->type) {
+        case NODE4: {
+            Node4 *n = static_cast<Node4*>(p);
+            for (int i = 0; i < n->count; i++) {
+                if (n->keys[i] == c) return &n->child[i];
+            }
+            return nullptr;
+        }
+        case NODE16: {
+            Node16 *n = static_cast<Node16*>(p);
+            #ifdef __SSE2__
+            __m128i eq = _mm_cmpeq_epi8(_mm_set1_epi8(char(c)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(n->keys)));
+            int bits = _mm_movemask_epi8(eq) & ((1 << n->count) - 1);
+            return bits ? &n->child[__builtin_ctz(bits)] : nullptr;
+            #else
+            for (int i = 0; i < n->count; i++) {
+                if (n->keys[i] == c) return &n->child[i];
+            }
+            return nullptr;
+            #endif
+        }
+        case NODE48: {
+            Node48 *n = static_cast<Node48*>(p);
+            return n->index[c] ? &n->child[n->index[c] - 1] : nullptr;
+        }
+        default: {
+            Node256 *n = static_cast<Node256*>(p);
+            return n->child[c] ? &n->child[c] : nullptr;
+        }
+        }
+    }
+
+    // Number of keys of a sorted node below c.
+    static int countBelow(const unsigned char *keys, int count, unsigned char c) {
+        int i = 0;
+        for (; i < count && keys[i] < c; i++);
+        return i;
+    }
+
+    static int countBelow16(const Node16 *n, unsigned char c) {
+        #ifdef __SSE2__
+        // Bytes compare signed, so flip the top bit of both sides.
+        __m128i flip = _mm_set1_epi8(char(0x80));
+        __m128i keys = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(n->keys)), flip);
+        __m128i lt = _mm_cmplt_epi8(keys, _mm_xor_si128(_mm_set1_epi8(char(c)), flip));
+        return __builtin_popcount(_mm_movemask_epi8(lt) & ((1 << n->count) - 1));
+        #else
+        return countBelow(n->keys, n->count, c);
+        #endif
+    }
+
+    // The child with the smallest byte >= c, or nullptr; c may be 256.
+    static Node* nextChild(const Node *p, int c, int &byte) {
+        switch (p->type) {
+        case NODE4:
+        case NODE16: {
+            const unsigned char *keys = p->type == NODE4 ? static_cast<const Node4*>(p)->keys : static_cast<const Node16*>(p)->keys;
+            Node* const *child = p->type == NODE4 ? static_cast<const Node4*>(p)->child : static_cast<const Node16*>(p)->child;
+            if (c > 255) return nullptr;
+            int i = p->type == NODE16 ? countBelow16(static_cast<const Node16*>(p), c) : countBelow(keys, p->count, c);
+            if (i == p->count) return nullptr;
+            byte = keys[i];
+            return child[i];
+        }
+        case NODE48: {
+            const Node48 *n = static_cast<const Node48*>(p);
+            for (; c < 256; c++) {
+                if (n->index[c]) {
+                    byte = c;
+                    return n->child[n->index[c] - 1];
+                }
+            }
+            return nullptr;
+        }
+        default: {
+            const Node256 *n = static_cast<const Node256*>(p);
+            for (; c < 256; c++) {
+                if (n->child[c]) {
+                    byte = c;
+                    return n->child[c];
+                }
+            }
+            return nullptr;
+        }
+        }
+    }
+
+    // The child with the largest byte <= c, or nullptr; c may be -1.
+    static Node* prevChild(const Node *p, int c) {
+        switch (p->type) {
+        case NODE4:
+        case NODE16: {
+            const unsigned char *keys = p->type == NODE4 ? static_cast<const Node4*>(p)->keys : static_cast<const Node16*>(p)->keys;
+            Node* const *child = p->type == NODE4 ? static_cast<const Node4*>(p)->child : static_cast<const Node16*>(p)->child;
+            int i = p->count;
+            for (; i > 0 && keys[i - 1] > c; i--);
+            return i ? child[i - 1] : nullptr;
+        }
+        case NODE48: {
+            const Node48 *n = static_cast<const Node48*>(p);
+            for (; c >= 0; c--) {
+                if (n->index[c]) return n->child[n->index[c] - 1];
+            }
+            return nullptr;
+        }
+        default: {
+            const Node256 *n = static_cast<const Node256*>(p);
+            for (; c >= 0 && !n->child[c]; c--);
+            return c >= 0 ? n->child[c] : nullptr;
+        }
+        }
+    }
+
+    // Calls f(child) in byte order until it returns true.
+    template <class F>
+    static bool eachChild(const Node *p, F f) {
+        int byte = 0;
+        for (const Node *c = nextChild(p, 0, byte); c; c = nextChild(p, byte + 1, byte)) {
+            if (f(c)) return true;
+        }
+        return false;
+    }
+
+    static Leaf* minLeaf(const Node *p) {
+        int byte;
+        for (; !isLeaf(p); p = nextChild(p, 0, byte)) {
+            if (p->term) return p->term;
+        }
+        return leafOf(p);
+    }
+
+    static Leaf* maxLeaf(const Node *p) {
+        for (; !isLeaf(p); ) {
+            if (!p->count) return p->term;
+            p = prevChild(p, 255);
+        }
+        return leafOf(p);
+    }
+
+    // The leaf that bytes of the prefix of p past PREFIX are read from, if p has any.
+    static const Leaf* prefixLeaf(const Node *p) {
+        return p->plen > PREFIX ? minLeaf(p) : nullptr;
+    }
+
+    // Byte i of the prefix of p, which starts at byte depth of its keys; low is prefixLeaf(p).
+    static unsigned char prefixAt(const Node *p, size_t i, size_t depth, const Leaf *low) {
+        return i < PREFIX ? p->prefix[i] : Bytes(low->key)[depth + i];
+    }
+
+    static void setPrefix(Node *p, const Bytes &k, size_t from, size_t len) {
+        p->plen = (unsigned int)len;
+        for (size_t i = 0; i < len && i < PREFIX; i++) p->prefix[i] = k[from + i];
+    }
+
+    // Drops the first s bytes of the prefix of p.
+    static void cutPrefix(Node *p, size_t s, size_t depth) {
+        unsigned char tmp[PREFIX];
+        size_t len = p->plen - s;
+        const Leaf *low = prefixLeaf(p);
+        for (size_t i = 0; i < len && i < PREFIX; i++) tmp[i] = prefixAt(p, s + i, depth, low);
+        std::copy(tmp, tmp + std::min(len, PREFIX), p->prefix);
+        p->plen = (unsigned int)len;
+    }
+
+    template <class N>
+    static N* newNode(const Node *from) {
+        N *n = new N();
+        n->plen = from->plen;
+        std::copy(from->prefix, from->prefix + PREFIX, n->prefix);
+        n->size = from->size;
+        n->term = from->term;
+        return n;
+    }
+
+    static Node4* newNode4() {
+        Node4 *n = new Node4();
+        n->type = NODE4;
+        return n;
+    }
+
+    static void freeNode(Node *p) {
+        switch (p->type) {
+        case NODE4: delete static_cast<Node4*>(p); break;
+        case NODE16: delete static_cast<Node16*>(p); break;
+        case NODE48: delete static_cast<Node48*>(p); break;
+        default: delete static_cast<Node256*>(p); break;
+        }
+    }
+
+    // Inserts into a sorted node with room left.
+    template <class N>
+    static void insertSorted(N *n, unsigned char c, Node *child) {
+        int i = n->type == NODE16 ? countBelow16(reinterpret_cast<Node16*>(n), c) : countBelow(n->keys, n->count, c);
+        std::copy_backward(n->keys + i, n->keys + n->count, n->keys + n->count + 1);
+        std::copy_backward(n->child + i, n->child + n->count, n->child + n->count + 1);
+        n->keys[i] = c;
+        n->child[i] = child;
+        n->count++;
+    }
+
+    // Adds child under byte c of *ref, moving *ref to the next layout when full.
+    static void addChild(Node *&ref, unsigned char c, Node *child) {
+        Node *p = ref;
+        switch (p->type) {
+        case NODE4: {
+            Node4 *n = static_cast<Node4*>(p);
+            if (n->count < 4) return insertSorted(n, c, child);
+            Node16 *m = newNode<Node16>(n);
+            m->type = NODE16;
+            m->count = 4;
+            std::copy(n->keys, n->keys + 4, m->keys);
+            std::copy(n->child, n->child + 4, m->child);
+            delete n;
+            ref = m;
+            return insertSorted(m, c, child);
+        }
+        case NODE16: {
+            Node16 *n = static_cast<Node16*>(p);
+            if (n->count < 16) return insertSorted(n, c, child);
+            Node48 *m = newNode<Node48>(n);
+            m->type = NODE48;
+            m->count = 16;
+            for (int i = 0; i < 16; i++) {
+                m->index[n->keys[i]] = (unsigned char)(i + 1);
+                m->child[i] = n->child[i];
+            }
+            delete n;
+            ref = p = m;
+            break;
+        }
+        case NODE48:
+            if (p->count == 48) {
+                Node48 *n = static_cast<Node48*>(p);
+                Node256 *m = newNode<Node256>(n);
+                m->type = NODE256;
+                m->count = 48;
+                for (int i = 0; i < 256; i++) {
+                    if (n->index[i]) m->child[i] = n->child[n->index[i] - 1];
+                }
+                delete n;
+                ref = p = m;
+            }
+            break;
+        default:
+            break;
+        }
+        if (p->type == NODE48) {
+            // Slots are filled in order and removals move the last slot down.
+            Node48 *n = static_cast<Node48*>(p);
+            n->child[n->count] = child;
+            n->index[c] = (unsigned char)++n->count;
+        } else {
+            static_cast<Node256*>(p)->child[c] = child;
+            p->count++;
+        }
+    }
+
+    template <class N>
+    static void eraseSorted(N *n, unsigned char c) {
+        int i = 0;
+        for (; n->keys[i] != c; i++);
+        std::copy(n->keys + i + 1, n->keys + n->count, n->keys + i);
+        std::copy(n->child + i + 1, n->child + n->count, n->child + i);
+        n->count--;
+    }
+
+    // Removes byte c from *ref, moving *ref to a smaller layout when it has room to spare.
+    static void removeChild(Node *&ref, unsigned char c) {
+        Node *p = ref;
+        switch (p->type) {
+        case NODE4:
+            eraseSorted(static_cast<Node4*>(p), c);
+            break;
+        case NODE16: {
+            Node16 *n = static_cast<Node16*>(p);
+            eraseSorted(n, c);
+            if (n->count > 3) break;
+            Node4 *m = newNode<Node4>(n);
+            m->type = NODE4;
+            m->count = n->count;
+            std::copy(n->keys, n->keys + n->count, m->keys);
+            std::copy(n->child, n->child + n->count, m->child);
+            delete n;
+            ref = m;
+            break;
+        }
+        case NODE48: {
+            Node48 *n = static_cast<Node48*>(p);
+            int i = n->index[c] - 1;
+            n->index[c] = 0;
+            if (i != --n->count) {
+                n->child[i] = n->child[n->count];
+                for (int b = 0; ; b++) {
+                    if (n->index[b] == n->count + 1) {
+                        n->index[b] = (unsigned char)(i + 1);
+                        break;
+                    }
+                }
+            }
+            if (n->count > 12) break;
+            Node16 *m = newNode<Node16>(n);
+            m->type = NODE16;
+            for (int b = 0; b < 256; b++) {
+                if (n->index[b]) {
+                    m->keys[m->count] = (unsigned char)b;
+                    m->child[m->count++] = n->child[n->index[b] - 1];
+                }
+            }
+            delete n;
+            ref = m;
+            break;
+        }
+        default: {
+            Node256 *n = static_cast<Node256*>(p);
+            n->child[c] = nullptr;
+            if (--n->count > 37) break;
+            Node48 *m = newNode<Node48>(n);
+            m->type = NODE48;
+            for (int b = 0; b < 256; b++) {
+                if (n->child[b]) {
+                    m->child[m->count] = n->child[b];
+                    m->index[b] = (unsigned char)++m->count;
+                }
+            }
+            delete n;
+            ref = m;
+            break;
+        }
+        }
+    }
+
+    // A node left with one entry is replaced by it, its prefix carried down.
+    static void compact(Node *&ref) {
+        Node *p = ref;
+        if (p->count + (p->term != nullptr) > 1) return;
+        int byte = 0;
+        Node *c = p->term ? tag(p->term) : nextChild(p, 0, byte);
+        if (!isLeaf(c)) {
+            unsigned char tmp[PREFIX];
+            size_t n = 0;
+            for (size_t i = 0; i < p->plen && n < PREFIX; i++) tmp[n++] = p->prefix[i];
+            if (n < PREFIX) tmp[n++] = (unsigned char)byte;
+            for (size_t i = 0; i < c->plen && n < PREFIX; i++) tmp[n++] = c->prefix[i];
+            std::copy(tmp, tmp + n, c->prefix);
+            c->plen += p->plen + 1;
+        }
+        freeNode(p);
+        ref = c;
+    }
+
+    void release(Node *p) {
+        if (isLeaf(p)) return delete leafOf(p);
+        if (p->term) delete p->term;
+        eachChild(p, [this](const Node *c) {
+            release(const_cast<Node*>(c));
+            return false;
+        });
+        freeNode(p);
+    }
+
+    void append(Leaf *leaf) {
+        leaf->prev = tail;
+        leaf->next = nullptr;
+        (tail ? tail->next : head) = leaf;
+        tail = leaf;
+    }
+
+    // Copies p, linking its leaves in order after tail.
+    Node* clone(const Node *p) {
+        if (isLeaf(p)) {
+            Leaf *leaf = new Leaf{nullptr, nullptr, leafOf(p)->key};
+            append(leaf);
+            return tag(leaf);
+        }
+        Node *q = nullptr;
+        switch (p->type) {
+        case NODE4: q = new Node4(*static_cast<const Node4*>(p)); break;
+        case NODE16: q = new Node16(*static_cast<const Node16*>(p)); break;
+        case NODE48: q = new Node48(*static_cast<const Node48*>(p)); break;
+        default: q = new Node256(*static_cast<const Node256*>(p)); break;
+        }
+        if (p->term) {
+            q->term = new Leaf{nullptr, nullptr, p->term->key};
+            append(q->term);
+        }
+        int byte = 0;
+        for (const Node *c = nextChild(p, 0, byte); c; c = nextChild(p, byte + 1, byte)) {
+            *findChild(q, (unsigned char)byte) = clone(c);
+        }
+        return q;
+    }
+
+    Leaf* nfind(const Bytes &k) const {
+        const Node *p = root;
+        size_t depth = 0;
+        ESET_COUNT(descents);
+        for (; p; ) {
+            ESET_COUNT(visits);
+            if (isLeaf(p)) break;
+            // Bytes past the stored prefix are checked against the leaf at the end.
+            if (depth + p->plen > k.size()) return nullptr;
+            for (size_t i = 0; i < p->plen && i < PREFIX; i++) {
+                if (p->prefix[i] != k[depth + i]) return nullptr;
+            }
+            depth += p->plen;
+            if (depth == k.size()) {
+                if (!p->term) return nullptr;
+                p = tag(p->term);
+                break;
+            }
+            Node **c = findChild(const_cast<Node*>(p), k[depth++]);
+            p = c ? *c : nullptr;
+        }
+        return p && !compare(Bytes(leafOf(p)->key), k) ? leafOf(p) : nullptr;
+    }
+
+    // The first key of p not below k, if any; p's keys share the first depth bytes of k.
+    static Leaf* findAbove(const Node *p, const Bytes &k, size_t depth) {
+        ESET_COUNT(visits);
+        if (isLeaf(p)) return compare(Bytes(leafOf(p)->key), k) >= 0 ? leafOf(p) : nullptr;
+        const Leaf *low = prefixLeaf(p);
+        for (size_t i = 0; i < p->plen; i++) {
+            if (depth + i == k.size()) return minLeaf(p);
+            unsigned char b = prefixAt(p, i, depth, low);
+            if (b != k[depth + i]) return b > k[depth + i] ? minLeaf(p) : nullptr;
+        }
+        depth += p->plen;
+        // A key ending here equals k or has k as a prefix; either way it is not below k.
+        if (depth == k.size()) return minLeaf(p);
+        unsigned char c = k[depth];
+        int byte;
+        if (Node **s = findChild(const_cast<Node*>(p), c)) {
+            if (Leaf *leaf = findAbove(*s, k, depth + 1)) return leaf;
+        }
+        const Node *next = nextChild(p, c + 1, byte);
+        return next ? minLeaf(next) : nullptr;
+    }
+
+    Leaf* findAbove(const Bytes &k, bool strict) const {
+        if (!root) return nullptr;
+        ESET_COUNT(descents);
+        Leaf *leaf = findAbove(root, k, 0);
+        if (strict && leaf && !compare(Bytes(leaf->key), k)) leaf = leaf->next;
+        return leaf;
+    }
+
+    // Keys under the children of p with a byte below c. Wide nodes sum
+    // whichever side of c is shorter and take it from the total.
+    static size_t sizeBelow(const Node *p, unsigned char c) {
+        size_t r = 0;
+        switch (p->type) {
+        case NODE4: {
+            const Node4 *n = static_cast<const Node4*>(p);
+            for (int i = 0, e = countBelow(n->keys, n->count, c); i < e; i++) r += sizeOf(n->child[i]);
+            return r;
+        }
+        case NODE16: {
+            const Node16 *n = static_cast<const Node16*>(p);
+            for (int i = 0, e = countBelow16(n, c); i < e; i++) r += sizeOf(n->child[i]);
+            return r;
+        }
+        case NODE48: {
+            const Node48 *n = static_cast<const Node48*>(p);
+            if (c < 128) {
+                for (int b = 0; b < c; b++) {
+                    if (n->index[b]) r += sizeOf(n->child[n->index[b] - 1]);
+                }
+                return r;
+            }
+            for (int b = c; b < 256; b++) {
+                if (n->index[b]) r += sizeOf(n->child[n->index[b] - 1]);
+            }
+            break;
+        }
+        default: {
+            const Node256 *n = static_cast<const Node256*>(p);
+            if (c < 128) {
+                for (int b = 0; b < c; b++) {
+                    if (n->child[b]) r += sizeOf(n->child[b]);
+                }
+                return r;
+            }
+            for (int b = c; b < 256; b++) {
+                if (n->child[b]) r += sizeOf(n->child[b]);
+            }
+            break;
+        }
+        }
+        return p->size - (p->term != nullptr) - r;
+    }
+
+    // Number of keys below k.
+    size_t position(const Bytes &k) const {
+        size_t r = 0, depth = 0;
+        ESET_COUNT(descents);
+        for (const Node *p = root; p; ) {
+            ESET_COUNT(visits);
+            if (isLeaf(p)) return r + (compare(Bytes(leafOf(p)->key), k) < 0);
+            const Leaf *low = prefixLeaf(p);
+            for (size_t i = 0; i < p->plen; i++) {
+                if (depth + i == k.size()) return r;
+                unsigned char b = prefixAt(p, i, depth, low);
+                if (b != k[depth + i]) return b < k[depth + i] ? r + p->size : r;
+            }
+            depth += p->plen;
+            if (depth == k.size()) return r;
+            if (p->term) r++;
+            unsigned char c = k[depth++];
+            r += sizeBelow(p, c);
+            Node **s = findChild(const_cast<Node*>(p), c);
+            p = s ? *s : nullptr;
+        }
+        return r;
+    }
+
+    // The k-th smallest key, or nullptr if k >= size().
+    Leaf* findNth(size_t k) const {
+        if (k >= size()) return nullptr;
+        const Node *p = root;
+        ESET_COUNT(descents);
+        for (; !isLeaf(p); ) {
+            ESET_COUNT(visits);
+            if (p->term) {
+                if (!k) return p->term;
+                k--;
+            }
+            const Node *next = nullptr;
+            eachChild(p, [&](const Node *c) {
+                if (k < sizeOf(c)) {
+                    next = c;
+                    return true;
+                }
+                k -= sizeOf(c);
+                return false;
+            });
+            p = next;
+        }
+        return leafOf(p);
+    }
+
+    // Hangs leaf under n, which is at byte depth of the key.
+    static void place(Node *&n, Leaf *leaf, const Bytes &k, size_t depth) {
+        if (k.size() == depth) n->term = leaf;
+        else addChild(n, k[depth], tag(leaf));
+    }
+
+    // Puts a leaf whose key is not in the set into the tree.
+    void insert(Leaf *leaf) {
+        Bytes k(leaf->key);
+        Node **ref = &root;
+        size_t depth = 0;
+        ESET_COUNT(descents);
+        for (;;) {
+            ESET_COUNT(visits);
+            Node *p = *ref;
+            if (!p) {
+                *ref = tag(leaf);
+                return;
+            }
+            if (isLeaf(p)) {
+                // Lazy expansion ends here: branch where the two keys part.
+                Leaf *other = leafOf(p);
+                Bytes o(other->key);
+                size_t i = depth;
+                for (; i < k.size() && i < o.size() && k[i] == o[i]; i++);
+                Node *n = newNode4();
+                setPrefix(n, k, depth, i - depth);
+                n->size = 2;
+                place(n, other, o, i);
+                place(n, leaf, k, i);
+                *ref = n;
+                return;
+            }
+            size_t m = 0;
+            const Leaf *low = prefixLeaf(p);
+            for (; m < p->plen && depth + m < k.size() && prefixAt(p, m, depth, low) == k[depth + m]; m++);
+            if (m < p->plen) {
+                // k leaves the prefix of p after m bytes: split it there.
+                Node *n = newNode4();
+                setPrefix(n, k, depth, m);
+                n->size = p->size + 1;
+                unsigned char b = prefixAt(p, m, depth, low);
+                cutPrefix(p, m + 1, depth);
+                addChild(n, b, p);
+                place(n, leaf, k, depth + m);
+                *ref = n;
+                return;
+            }
+            depth += p->plen;
+            p->size++;
+            if (depth == k.size()) {
+                p->term = leaf;
+                return;
+            }
+            Node **c = findChild(p, k[depth]);
+            if (!c) {
+                addChild(*ref, k[depth], tag(leaf));
+                return;
+            }
+            ref = c;
+            depth++;
+        }
+    }
+
+    // Takes k out of the tree below *ref, returning its leaf.
+    static Leaf* remove(Node *&ref, const Bytes &k, size_t depth) {
+        ESET_COUNT(visits);
+        Node *p = ref;
+        if (isLeaf(p)) {
+            if (compare(Bytes(leafOf(p)->key), k)) return nullptr;
+            ref = nullptr;
+            return leafOf(p);
+        }
+        if (depth + p->plen > k.size()) return nullptr;
+        for (size_t i = 0; i < p->plen && i < PREFIX; i++) {
+            if (p->prefix[i] != k[depth + i]) return nullptr;
+        }
+        depth += p->plen;
+        Leaf *leaf = nullptr;
+        if (depth == k.size()) {
+            if (!p->term || compare(Bytes(p->term->key), k)) return nullptr;
+            leaf = p->term;
+            p->term = nullptr;
+        } else {
+            Node **c = findChild(p, k[depth]);
+            if (!c || !(leaf = remove(*c, k, depth + 1))) return nullptr;
+            if (!*c) removeChild(ref, k[depth]);
+        }
+        ref->size--;
+        compact(ref);
+        return leaf;
+    }
+
+    void unlink(Leaf *leaf) {
+        (leaf->prev ? leaf->prev->next : head) = leaf->next;
+        (leaf->next ? leaf->next->prev : tail) = leaf->prev;
+    }
+
+    template <class K>
+    static Bytes bytesOf(const K &key) {
+        return Bytes(key);
+    }
+
+    #ifdef DEBUG
+    void debug_print(const Node *p, int depth) const {
+        if (isLeaf(p)) {
+            std::cerr << std::string(depth * 2, ' ') << "leaf: " << leafOf(p)->key << "\n";
+            return;
+        }
+        std::cerr << std::string(depth * 2, ' ') << "node" << (p->type == NODE4 ? 4 : p->type == NODE16 ? 16 : p->type == NODE48 ? 48 : 256)
+                  << ", prefix: " << p->plen << ", size: " << p->size << (p->term ? ", term" : "") << "\n";
+        eachChild(p, [&](const Node *c) {
+            debug_print(c, depth + 1);
+            return false;
+        });
+    }
+    #endif
+
+public:
+    class iterator {
+        friend class ESet;
+    private:
+        const ESet *from;
+        const Leaf *leaf;
+
+        iterator(const Leaf *leaf, const ESet *from) : from{from}, leaf{leaf} {}
+
+    public:
+        iterator() : from{nullptr}, leaf{nullptr} {}
+
+        const Key& operator*() const {
+            if (!leaf) throw std::out_of_range("Out of range");
+            return leaf->key;
+        }
+
+        const Key* operator->() const {
+            if (!leaf) throw std::out_of_range("Out of range");
+            return &leaf->key;
+        }
+
+        // Along the leaf list, O(1).
+        iterator& operator++() {
+            if (leaf) leaf = leaf->next;
+            return *this;
+        }
+
+        iterator& operator--() {
+            if (!from) return *this;
+            const Leaf *tmp = leaf ? leaf->prev : from->tail;
+            if (tmp) leaf = tmp;
+            return *this;
+        }
+
+        // Moves k positions in two descents, stopping at begin() or end().
+        iterator& operator+=(std::ptrdiff_t k) {
+            if (!from) return *this;
+            size_t i = leaf ? from->position(Bytes(leaf->key)) : from->size();
+            if (k < 0) i = size_t(-k) < i ? i + k : 0;
+            else i += k;
+            leaf = from->findNth(i);
+            return *this;
+        }
+
+        iterator& operator-=(std::ptrdiff_t k) {
+            return *this += -k;
+        }
+
+        iterator operator+(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp += k;
+        }
+
+        iterator operator-(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp -= k;
+        }
+
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        iterator operator--(int) {
+            iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const iterator &other) const {
+            return from == other.from && leaf == other.leaf;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return from != other.from || leaf != other.leaf;
+        }
+    };
+
+    ESet() : root{nullptr}, head{nullptr}, tail{nullptr} {}
+
+    ~ESet() {
+        clear();
+    }
+
+    ESet(const ESet &other) : root{nullptr}, head{nullptr}, tail{nullptr} {
+        if (other.root) root = clone(other.root);
+    }
+
+    ESet& operator=(const ESet &other) {
+        if (&other == this) return *this;
+        clear();
+        if (other.root) root = clone(other.root);
+        return *this;
+    }
+
+    ESet(ESet &&other) noexcept : root{other.root}, head{other.head}, tail{other.tail} {
+        other.root = nullptr;
+        other.head = other.tail = nullptr;
+    }
+
+    ESet& operator=(ESet &&other) noexcept {
+        if (&other == this) return *this;
+        std::swap(root, other.root);
+        std::swap(head, other.head);
+        std::swap(tail, other.tail);
+        return *this;
+    }
+
+private:
+    template <class K>
+    std::pair<iterator, bool> emplaceKey(std::true_type, K &&key) {
+        Bytes k = bytesOf(key);
+        Leaf *next = findAbove(k, false);
+        if (next && !compare(Bytes(next->key), k)) return std::make_pair(iterator(next, this), false);
+        Leaf *leaf = new Leaf{nullptr, nullptr, Key(std::forward<K>(key))};
+        insert(leaf);
+        leaf->next = next;
+        leaf->prev = next ? next->prev : tail;
+        (leaf->prev ? leaf->prev->next : head) = leaf;
+        (next ? next->prev : tail) = leaf;
+        return std::make_pair(iterator(leaf, this), true);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplaceKey(std::false_type, Args &&... args) {
+        return emplaceKey(std::true_type(), Key(std::forward<Args>(args)...));
+    }
+
+public:
+    // The Key is only made once it is known to be new, if the argument can be looked up as is.
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        return emplaceKey(EmplaceLookup<Args...>(), std::forward<Args>(args)...);
+    }
+
+    size_t erase(const Key &key) {
+        return erase<Key>(key);
+    }
+
+    template <class K, class = Lookup<K>>
+    size_t erase(const K &key) {
+        if (!root) return 0;
+        ESET_COUNT(descents);
+        Leaf *leaf = remove(root, bytesOf(key), 0);
+        if (!leaf) return 0;
+        unlink(leaf);
+        delete leaf;
+        return 1;
+    }
+
+    iterator find(const Key &key) const {
+        return find<Key>(key);
+    }
+
+    template <class K, class = Lookup<K>>
+    iterator find(const K &key) const {
+        return iterator(nfind(bytesOf(key)), this);
+    }
+
+    void clear() noexcept {
+        if (root) release(root);
+        root = nullptr;
+        head = tail = nullptr;
+    }
+
+    // Keys in [l, r]: two counting descents.
+    size_t range(const Key &l, const Key &r) const {
+        return range<Key>(l, r);
+    }
+
+    template <class K, class = Lookup<K>>
+    size_t range(const K &l, const K &r) const {
+        Bytes a = bytesOf(l), b = bytesOf(r);
+        if (compare(b, a) < 0) return 0;
+        return position(b) + (nfind(b) != nullptr) - position(a);
+    }
+
+    // The k-th smallest key, counting from 0, or end() if k >= size().
+    iterator nth(size_t k) const {
+        return iterator(findNth(k), this);
+    }
+
+    // Number of keys less than key.
+    size_t rank(const Key &key) const {
+        return rank<Key>(key);
+    }
+
+    template <class K, class = Lookup<K>>
+    size_t rank(const K &key) const {
+        return position(bytesOf(key));
+    }
+
+    size_t size() const noexcept {
+        return root ? sizeOf(root) : 0;
+    }
+
+    iterator lower_bound(const Key &key) const {
+        return lower_bound<Key>(key);
+    }
+
+    template <class K, class = Lookup<K>>
+    iterator lower_bound(const K &key) const {
+        return iterator(findAbove(bytesOf(key), false), this);
+    }
+
+    iterator upper_bound(const Key &key) const {
+        return upper_bound<Key>(key);
+    }
+
+    template <class K, class = Lookup<K>>
+    iterator upper_bound(const K &key) const {
+        return iterator(findAbove(bytesOf(key), true), this);
+    }
+
+    iterator begin() const noexcept {
+        return iterator(head, this);
+    }
+
+    iterator end() const noexcept {
+        return iterator(nullptr, this);
+    }
+
+    #ifdef DEBUG
+    void debug_print() const {
+        if (root) debug_print(root, 0);
+    }
+    #endif
+};
+
+} // namespace eset::art
+
+#if !defined(ESET_NO_GLOBAL) && !defined(ESET_GLOBAL_DEFINED)
+#define ESET_GLOBAL_DEFINED
+template <class Key, class Compare = std::less<Key>>
+using ESet = eset::art::ESet<Key, Compare>;
+#endif
+
+#endif // ESET_ART_HPP
@@ -0,0 +1,286 @@
+#ifndef ESET_AVL_HPP
+#define ESET_AVL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus > 201703L
+#include <compare>
+#endif
+
+#ifdef DEBUG
+#include <iostream>
+#endif
+
+#include "../common/bst.hpp"
+
+namespace eset::avl {
+
+template <class Key>
+struct AvlNode {
+    AvlNode *s[2], *fa;
+    size_t size;
+    int height;
+    // Constructed by newLeaf/cloneNode only, so nil has none.
+    union {
+        Key key;
+    };
+
+    AvlNode() : s{nullptr, nullptr}, fa{nullptr}, size{0}, height{0} {}
+
+    ~AvlNode() {}
+
+    void link(int pos, AvlNode *son) {
+        son->fa = this;
+        this->s[pos] = son;
+    }
+};
+
+/*
+AVL tree with parent pointers and subtree sizes, laid out like the
+red-black tree. The two subtrees of a node differ in height by at most one,
+so the tree is at most about 1.44 log n high against 2 log n for red-black,
+and searches visit fewer nodes.
+
+After an emplace or erase, balance is repaired going up only while the
+height of the subtree keeps changing. Above that point the ancestors just
+have their sizes adjusted, so most updates do their rotations near the
+leaves and a plain size walk above.
+*/
+template <class Key, class Compare = std::less<Key>>
+class ESet : public ESetTree<ESet<Key, Compare>, AvlNode<Key>, Key, Compare> {
+    friend ESetTree<ESet, AvlNode<Key>, Key, Compare>;
+
+private:
+    typedef AvlNode<Key> Node;
+    typedef ESetTree<ESet, Node, Key, Compare> BST;
+
+    using BST::root;
+    using BST::nil;
+    using BST::pool;
+    using BST::cmp;
+    using BST::order;
+    using BST::recollect;
+    using BST::freeNode;
+    using BST::clone;
+    using BST::dir;
+    using BST::nfind;
+
+    Node* cloneNode(const Node *src) {
+        Node *dest = pool.allocate();
+        dest->height = src->height;
+        dest->size = src->size;
+        dest->s[0] = dest->s[1] = nil;
+        new (&dest->key) Key(src->key);
+        return dest;
+    }
+
+    template <class K>
+    Node* newLeaf(K &&key) {
+        Node *leaf = pool.allocate();
+        new (&leaf->key) Key(std::forward<K>(key));
+        leaf->link(0, nil);
+        leaf->link(1, nil);
+        leaf->height = 1;
+        leaf->size = 1;
+        return leaf;
+    }
+
+    static int balance(const Node *x) {
+        return x->s[0]->height - x->s[1]->height;
+    }
+
+    void update(Node *x) {
+        x->size = x->s[0]->size + x->s[1]->size + 1;
+        x->height = std::max(x->s[0]->height, x->s[1]->height) + 1;
+    }
+
+    // Lift x above its parent.
+    void rotate(Node *x) {
+        ESET_COUNT(rotations);
+        Node *y = x->fa, *z = y->fa;
+        int t = dir(x);
+        if (y != root) {
+            z->link(dir(y), x);
+        } else {
+            root = x;
+            x->fa = nil;
+        }
+        y->link(t, x->s[t^1]);
+        x->link(t^1, y);
+        update(y);
+        update(x);
+    }
+
+    // Rebalance x, whose subtrees differ in height by two, and return the new top of its subtree.
+    Node* fix(Node *x) {
+        int t = balance(x) < 0;
+        Node *c = x->s[t];
+        if (c->s[t^1]->height > c->s[t]->height) {
+            Node *g = c->s[t^1];
+            rotate(g);
+            rotate(g);
+            return g;
+        }
+        rotate(c);
+        return c;
+    }
+
+    /*
+    Walk up from x, whose subtree just gained (d = 1) or lost (d = -1) a
+    node, repairing heights and balance. Once a subtree comes out as high as
+    before, nothing above it can change but the sizes.
+    */
+    void retrace(Node *x, int d) {
+        for (; x != nil; x = x->fa) {
+            int h = x->height;
+            update(x);
+            if (balance(x) > 1 || balance(x) < -1) x = fix(x);
+            if (x->height == h) {
+                for (x = x->fa; x != nil; x = x->fa) x->size += d;
+                return;
+            }
+        }
+    }
+
+    /*
+    Swap the positions of x and its successor y in the tree, heights and
+    sizes staying with the positions, so iterators to y stay valid while x
+    is being erased.
+    */
+    void exchange(Node *x, Node *y) {
+        Node *xf = x->fa, *xl = x->s[0], *xr = x->s[1], *yf = y->fa, *yr = y->s[1];
+        bool xroot = x == root;
+        int xd = xroot ? 0 : dir(x);
+        std::swap(x->height, y->height);
+        std::swap(x->size, y->size);
+        if (yf == x) {
+            y->link(1, x);
+        } else {
+            yf->link(0, x);
+            y->link(1, xr);
+        }
+        x->link(0, nil);
+        x->link(1, yr);
+        y->link(0, xl);
+        if (xroot) {
+            root = y;
+            y->fa = nil;
+        } else xf->link(xd, y);
+    }
+
+    #ifdef DEBUG
+    void debug_print(Node *ptr, int x) const {
+        if (ptr == nil) return;
+        std::cerr << x << ": height: " << ptr->height << ", size: " << ptr->size << ", key: " << ptr->key << "\n";
+        debug_print(ptr->s[0], x*2);
+        debug_print(ptr->s[1], x*2+1);
+    }
+    #endif
+
+public:
+    using typename BST::iterator;
+
+    ESet() = default;
+
+    ESet(const ESet &other) : BST(other) {
+        root = clone(other.root, other);
+    }
+
+    ESet& operator=(const ESet &other) {
+        if (&other == this) return *this;
+        // Like clear(), but the memory of the old tree is reused for the copy.
+        if (root != nil) recollect(root);
+        pool.reset(other.size());
+        root = clone(other.root, other);
+        return *this;
+    }
+
+    ESet(ESet &&other) noexcept = default;
+    ESet& operator=(ESet &&other) noexcept = default;
+
+private:
+    template <class K>
+    std::pair<iterator, bool> emplaceKey(std::true_type, K &&key) {
+        if (root == nil) {
+            root = newLeaf(std::forward<K>(key));
+            root->fa = nil;
+            return std::make_pair(iterator(root, this), true);
+        }
+        Node *p = root;
+        int t;
+        ESET_COUNT(descents);
+        for (;;) {
+            ESET_COUNT(visits);
+            int c = order(key, p->key);
+            if (!c) return std::make_pair(iterator(p, this), false);
+            t = c > 0;
+            if (p->s[t] == nil) break;
+            p = p->s[t];
+        }
+        Node *x = newLeaf(std::forward<K>(key));
+        p->link(t, x);
+        root->fa = nil;
+        retrace(p, 1);
+        return std::make_pair(iterator(x, this), true);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplaceKey(std::false_type, Args &&... args) {
+        return emplaceKey(std::true_type(), Key(std::forward<Args>(args)...));
+    }
+
+public:
+    // The Key is only made once it is known to be new, if the argument can be looked up as is.
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        return emplaceKey(ESetEmplaceLookup<Compare, Key, Args...>(), std::forward<Args>(args)...);
+    }
+
+    size_t erase(const Key &key) {
+        return erase<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t erase(const K &key) {
+        Node *x = nfind(key);
+        if (x == nil) return 0;
+        root->fa = nil;
+        if (x->s[0] != nil && x->s[1] != nil) {
+            Node *y = x->s[1];
+            for (; y->s[0] != nil; y = y->s[0]);
+            exchange(x, y);
+        }
+        // Now x has at most one child, which takes its place.
+        Node *y = x->s[0] != nil ? x->s[0] : x->s[1], *p = x->fa;
+        if (x == root) {
+            root = y;
+            y->fa = nil;
+        } else {
+            p->link(dir(x), y);
+            retrace(p, -1);
+        }
+        freeNode(x);
+        return 1;
+    }
+
+    #ifdef DEBUG
+    void debug_print() const {
+        debug_print(root, 1);
+    }
+    #endif
+};
+
+} // namespace eset::avl
+
+#if !defined(ESET_NO_GLOBAL) && !defined(ESET_GLOBAL_DEFINED)
+#define ESET_GLOBAL_DEFINED
+template <class Key, class Compare = std::less<Key>>
+using ESet = eset::avl::ESet<Key, Compare>;
+#endif
+
+#endif // ESET_AVL_HPP
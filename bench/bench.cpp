@@ -0,0 +1,560 @@
+/*
+Cross-backend benchmark for ESet.
+
+The same workload is compiled against whichever `eset.hpp` is found on the
+include path (see run.sh), or against std::set when BENCH_STD_SET is defined.
+BENCH_PERSISTENT selects the persistent mode (ESet<Key, Compare, true>).
+Against the top-level eset.hpp (-I..), BENCH_POLICY picks the backend
+instead, e.g. -DBENCH_POLICY=eset::Splay.
+Every operation is timed individually, so besides throughput we can report
+the latency distribution (p50/p99/p999) of each kind of operation.
+
+Built with -DESET_STATS (STATS=1 ./run.sh), the structural counters of the
+backend (rotations, recolors, splay steps, copied nodes, comparisons, nodes
+visited per descent) are reported per operation as well. Timings of such a
+build include the counting, so use it to explain numbers, not to take them.
+
+With `-t file` it replays an op stream in the test/1.in format instead (see
+gen.cpp), with the same iterator semantics as test/1.cpp.
+
+Usage: bench [-n M] [-c copies] [-r reps] [-w warmup] [-s seed] [-t trace]
+             [-f table|csv|json] [-b backend-name] [--no-header]
+*/
+
+#ifdef BENCH_STD_SET
+#include <set>
+#include <iterator>
+#else
+#include "eset.hpp"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef BENCH_STD_SET
+/*
+std::set behind the ESet interface, used as the reference backend. The
+iterator is wrapped because ESet defines ++end() and --begin() as no-ops,
+which the trace driver relies on and which is undefined for std::set.
+*/
+template <class Key, class Compare = std::less<Key>>
+class ESet {
+private:
+    typedef std::set<Key, Compare> Set;
+    Set s;
+
+public:
+    class iterator {
+        friend class ESet;
+    private:
+        const Set *from;
+        typename Set::const_iterator it;
+
+        iterator(const Set *from, typename Set::const_iterator it) : from(from), it(it) {}
+
+    public:
+        iterator() : from(nullptr) {}
+
+        const Key& operator*() const { return *it; }
+
+        iterator& operator++() {
+            if (it != from->end()) ++it;
+            return *this;
+        }
+
+        iterator& operator--() {
+            if (it != from->begin()) --it;
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const { return from == other.from && it == other.it; }
+
+        bool operator!=(const iterator &other) const { return !(*this == other); }
+    };
+
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        auto p = s.emplace(std::forward<Args>(args)...);
+        return std::make_pair(iterator(&s, p.first), p.second);
+    }
+
+    size_t erase(const Key &key) { return s.erase(key); }
+
+    size_t size() const { return s.size(); }
+
+    size_t range(const Key &l, const Key &r) const {
+        if (s.key_comp()(r, l)) return 0;
+        return std::distance(s.lower_bound(l), s.upper_bound(r));
+    }
+
+    iterator find(const Key &key) const { return iterator(&s, s.find(key)); }
+
+    iterator lower_bound(const Key &key) const { return iterator(&s, s.lower_bound(key)); }
+
+    iterator upper_bound(const Key &key) const { return iterator(&s, s.upper_bound(key)); }
+
+    iterator begin() const { return iterator(&s, s.begin()); }
+
+    iterator end() const { return iterator(&s, s.end()); }
+};
+#endif
+
+#if defined(ESET_STATS) && !defined(BENCH_STD_SET)
+#define BENCH_STATS
+#endif
+
+// -DBENCH_PERSISTENT benchmarks the persistent mode of backends that have one.
+#if defined(BENCH_POLICY)
+template <class K> using BenchSet = ESet<K, std::less<K>, BENCH_POLICY>;
+#elif defined(BENCH_PERSISTENT)
+template <class K> using BenchSet = ESet<K, std::less<K>, true>;
+#else
+template <class K> using BenchSet = ESet<K>;
+#endif
+
+#ifndef BENCH_BACKEND
+#ifdef BENCH_STD_SET
+#define BENCH_BACKEND "std::set"
+#else
+#define BENCH_BACKEND "eset"
+#endif
+#endif
+
+typedef unsigned int Key;
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    unsigned int m = 100000;
+    int copies = 100;
+    int reps = 5;
+    int warmup = 1;
+    unsigned int seed = 1;
+    std::string format = "table";
+    std::string backend = BENCH_BACKEND;
+    std::string trace;
+    bool header = true;
+};
+
+struct Op {
+    int op;
+    long long a, b, c;
+};
+
+class Rand {
+private:
+    unsigned int n, m;
+
+public:
+    Rand(unsigned int seed, unsigned int m) : n(seed ? seed : 1), m(m) {}
+
+    // Same xorshift as the old speed.cpp, so numbers stay comparable.
+    unsigned int operator()() {
+        n = (n << 13) ^ n;
+        n = (n >> 17) ^ n;
+        n = (n << 5) ^ n;
+        return n % m;
+    }
+};
+
+/*
+Latency samples of one kind of operation, collected over all measured
+repetitions. `rep_ns` keeps the total time of each repetition so that the
+run-to-run noise can be reported next to the mean.
+*/
+struct Samples {
+    std::string op;
+    std::vector<double> ns;
+    std::vector<double> rep_ns;
+    std::vector<size_t> rep_cnt;
+#ifdef BENCH_STATS
+    ESetStats stats;
+#endif
+};
+
+#ifdef BENCH_STATS
+struct StatField {
+    const char *name;
+    size_t ESetStats::*field;
+};
+
+const StatField stat_fields[] = {
+    {"rotations", &ESetStats::rotations},
+    {"recolors", &ESetStats::recolors},
+    {"splays", &ESetStats::splays},
+    {"copies", &ESetStats::copies},
+    {"compares", &ESetStats::compares},
+    {"descents", &ESetStats::descents},
+    {"visits", &ESetStats::visits},
+};
+#endif
+
+class Recorder {
+private:
+    std::vector<Samples> ops;
+    double overhead;
+    bool active;
+
+    Samples& get(const char *op) {
+        for (auto &s : ops) if (s.op == op) return s;
+        ops.emplace_back();
+        ops.back().op = op;
+        return ops.back();
+    }
+
+public:
+    Recorder() : overhead(0), active(false) {
+        // Cost of an empty timed region, subtracted from every sample.
+        std::vector<double> v;
+        for (int i = 0; i < 10000; i++) {
+            auto a = Clock::now();
+            auto b = Clock::now();
+            v.push_back(std::chrono::duration<double, std::nano>(b - a).count());
+        }
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        overhead = v[v.size() / 2];
+    }
+
+    void setActive(bool a) { active = a; }
+
+    double clockOverhead() const { return overhead; }
+
+    const std::vector<Samples>& result() const { return ops; }
+
+    void beginRep() {
+        for (auto &s : ops) s.rep_ns.push_back(0), s.rep_cnt.push_back(0);
+    }
+
+    template <class F>
+    void time(const char *op, F &&f) {
+#ifdef BENCH_STATS
+        ESetStats before = ESetStats::get();
+#endif
+        auto a = Clock::now();
+        f();
+        auto b = Clock::now();
+        if (!active) return;
+        double t = std::chrono::duration<double, std::nano>(b - a).count() - overhead;
+        if (t < 0) t = 0;
+        Samples &s = get(op);
+        if (s.rep_ns.empty()) s.rep_ns.push_back(0), s.rep_cnt.push_back(0);
+        s.ns.push_back(t);
+        s.rep_ns.back() += t;
+        s.rep_cnt.back()++;
+#ifdef BENCH_STATS
+        for (auto &f : stat_fields) s.stats.*f.field += ESetStats::get().*f.field - before.*f.field;
+#endif
+    }
+};
+
+// Values are folded into this so that the compiler cannot drop the work.
+static volatile unsigned long long sink;
+
+/*
+One repetition of the workload. It follows the old speed.cpp test1() and adds
+the operations that were not measured there.
+*/
+void runSpeed(const Options &opt, unsigned int seed, Recorder &rec) {
+    Rand rnd(seed, opt.m);
+    unsigned long long acc = 0;
+    const unsigned int n = 2 * opt.m;
+    BenchSet<Key> s, s_;
+
+    for (unsigned int i = 0; i < n; i++) {
+        Key k = rnd();
+        rec.time("emplace", [&] { acc += s.emplace(k).second; });
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        Key k = rnd();
+        rec.time("erase", [&] { acc += s.erase(k); });
+    }
+    for (unsigned int i = 0; i < n; i++) s.emplace(rnd());
+
+    for (int i = 0; i < opt.copies; i++) {
+        rec.time("copy", [&] { s_ = s; });
+    }
+    acc += s_.size();
+
+    for (unsigned int i = 0; i < n; i++) {
+        Key k = rnd();
+        rec.time("find", [&] { acc += (s.find(k) != s.end()); });
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        Key k = rnd();
+        rec.time("lower_bound", [&] { acc += (s.lower_bound(k) != s.end()); });
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        Key k = rnd();
+        rec.time("upper_bound", [&] { acc += (s.upper_bound(k) != s.end()); });
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        Key l = rnd(), r = l + rnd() % 1000;
+        rec.time("range", [&] { acc += s.range(l, r); });
+    }
+
+    auto it = s.begin();
+    for (; it != s.end(); ) {
+        acc += *it;
+        rec.time("iter_inc", [&] { ++it; });
+    }
+    // begin() walks the left spine, which a splay tree has just made long.
+    auto first = s.begin();
+    for (it = s.end(); it != first; ) {
+        rec.time("iter_dec", [&] { --it; });
+        acc += *it;
+    }
+
+    sink = sink + acc;
+}
+
+std::vector<Op> readTrace(const std::string &file, size_t &sets) {
+    FILE *f = fopen(file.c_str(), "r");
+    if (!f) {
+        perror(file.c_str());
+        exit(1);
+    }
+    std::vector<Op> ops;
+    Op o = {0, 0, 0, 0};
+    sets = 1;
+    while (fscanf(f, "%d", &o.op) == 1) {
+        if (o.op == 0 || o.op == 1 || o.op == 3) {
+            if (fscanf(f, "%lld%lld", &o.a, &o.b) != 2) break;
+        } else if (o.op == 2) {
+            if (fscanf(f, "%lld", &o.a) != 1) break;
+            sets++;
+        } else if (o.op == 4) {
+            if (fscanf(f, "%lld%lld%lld", &o.a, &o.b, &o.c) != 3) break;
+        }
+        ops.push_back(o);
+    }
+    fclose(f);
+    return ops;
+}
+
+/*
+One replay of a trace. The bookkeeping around `it` mirrors test/1.cpp and
+treap/1.cpp, so the timed calls are exactly the ones the OJ driver makes.
+Returns the sum of everything the driver would have printed.
+*/
+unsigned long long runTrace(const std::vector<Op> &ops, size_t sets, Recorder &rec) {
+    std::vector<BenchSet<long long>> s(sets);
+    BenchSet<long long>::iterator it;
+    long long it_a = -1, lst = 0;
+    bool valid = false;
+    unsigned long long acc = 0;
+
+    for (const Op &o : ops) {
+        switch (o.op) {
+        case 0:
+            rec.time("emplace", [&] {
+                auto p = s[o.a].emplace(o.b);
+                if (p.second) it = p.first, it_a = o.a, valid = true;
+            });
+            break;
+        case 1:
+            if (valid && it_a == o.a && *it == o.b) valid = false;
+            rec.time("erase", [&] { s[o.a].erase(o.b); });
+            break;
+        case 2:
+            rec.time("copy", [&] { s[++lst] = s[o.a]; });
+            break;
+        case 3:
+            rec.time("find", [&] {
+                auto it2 = s[o.a].find(o.b);
+                if (it2 != s[o.a].end()) it = it2, it_a = o.a, valid = true, acc++;
+            });
+            break;
+        case 4:
+            rec.time("range", [&] { acc += s[o.a].range(o.b, o.c); });
+            break;
+        case 5:
+            if (!valid) break;
+            rec.time("iter_dec", [&] {
+                auto it2 = it;
+                if (it == --it2) valid = false;
+                else acc += *--it;
+            });
+            break;
+        case 6:
+            if (!valid) break;
+            rec.time("iter_inc", [&] {
+                auto it2 = ++it;
+                if (it == ++it2) valid = false;
+                else acc += *it;
+            });
+            break;
+        }
+    }
+    return acc;
+}
+
+double percentile(const std::vector<double> &sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t i = (size_t)std::ceil(q * sorted.size());
+    if (i > 0) i--;
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+struct Row {
+    std::string op;
+    size_t count;
+    double total_ms, ops_per_sec, mean_ns, rsd, p50, p99, p999, max;
+#ifdef BENCH_STATS
+    // Per-operation averages, in the order of stat_fields.
+    std::vector<double> stats;
+#endif
+};
+
+Row summarize(Samples s) {
+    Row r;
+    r.op = s.op;
+    r.count = s.ns.size();
+    double sum = 0;
+    for (double t : s.ns) sum += t;
+    r.total_ms = sum / 1e6;
+    r.mean_ns = r.count ? sum / r.count : 0;
+    r.ops_per_sec = sum > 0 ? r.count / (sum / 1e9) : 0;
+
+    // Relative standard deviation of the per-repetition mean latency.
+    std::vector<double> means;
+    for (size_t i = 0; i < s.rep_ns.size(); i++) {
+        if (s.rep_cnt[i]) means.push_back(s.rep_ns[i] / s.rep_cnt[i]);
+    }
+    double mu = 0, var = 0;
+    for (double m : means) mu += m;
+    if (!means.empty()) mu /= means.size();
+    for (double m : means) var += (m - mu) * (m - mu);
+    if (means.size() > 1) var /= means.size() - 1;
+    r.rsd = mu > 0 ? std::sqrt(var) / mu * 100 : 0;
+
+    std::sort(s.ns.begin(), s.ns.end());
+    r.p50 = percentile(s.ns, 0.5);
+    r.p99 = percentile(s.ns, 0.99);
+    r.p999 = percentile(s.ns, 0.999);
+    r.max = s.ns.empty() ? 0 : s.ns.back();
+#ifdef BENCH_STATS
+    for (auto &f : stat_fields) r.stats.push_back(r.count ? (double)(s.stats.*f.field) / r.count : 0);
+#endif
+    return r;
+}
+
+void print(const Options &opt, const std::vector<Row> &rows, double overhead) {
+    const char *b = opt.backend.c_str();
+    if (opt.format == "csv") {
+        if (opt.header) {
+            printf("backend,op,count,total_ms,ops_per_sec,mean_ns,rsd_pct,p50_ns,p99_ns,p999_ns,max_ns");
+#ifdef BENCH_STATS
+            for (auto &f : stat_fields) printf(",%s", f.name);
+#endif
+            printf("\n");
+        }
+        for (auto &r : rows) {
+            printf("%s,%s,%zu,%.3f,%.0f,%.1f,%.2f,%.1f,%.1f,%.1f,%.1f", b, r.op.c_str(), r.count,
+                   r.total_ms, r.ops_per_sec, r.mean_ns, r.rsd, r.p50, r.p99, r.p999, r.max);
+#ifdef BENCH_STATS
+            for (double v : r.stats) printf(",%.3f", v);
+#endif
+            printf("\n");
+        }
+    } else if (opt.format == "json") {
+        printf("{\"backend\": \"%s\", \"m\": %u, \"reps\": %d, \"warmup\": %d, \"seed\": %u, "
+               "\"clock_overhead_ns\": %.1f, \"ops\": [", b, opt.m, opt.reps, opt.warmup, opt.seed, overhead);
+        for (size_t i = 0; i < rows.size(); i++) {
+            const Row &r = rows[i];
+            printf("%s\n  {\"op\": \"%s\", \"count\": %zu, \"total_ms\": %.3f, \"ops_per_sec\": %.0f, "
+                   "\"mean_ns\": %.1f, \"rsd_pct\": %.2f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, "
+                   "\"p999_ns\": %.1f, \"max_ns\": %.1f", i ? "," : "", r.op.c_str(), r.count,
+                   r.total_ms, r.ops_per_sec, r.mean_ns, r.rsd, r.p50, r.p99, r.p999, r.max);
+#ifdef BENCH_STATS
+            printf(", \"stats\": {");
+            for (size_t j = 0; j < r.stats.size(); j++) {
+                printf("%s\"%s\": %.3f", j ? ", " : "", stat_fields[j].name, r.stats[j]);
+            }
+            printf("}");
+#endif
+            printf("}");
+        }
+        printf("\n]}\n");
+    } else {
+        printf("backend: %s, m: %u, reps: %d (+%d warm-up), clock overhead: %.1f ns\n",
+               b, opt.m, opt.reps, opt.warmup, overhead);
+        printf("%-12s %10s %11s %12s %9s %7s %9s %9s %9s %10s\n", "op", "count", "total(ms)",
+               "ops/s", "mean(ns)", "rsd%", "p50(ns)", "p99(ns)", "p999(ns)", "max(ns)");
+        for (auto &r : rows) {
+            printf("%-12s %10zu %11.3f %12.0f %9.1f %7.2f %9.1f %9.1f %9.1f %10.1f\n", r.op.c_str(),
+                   r.count, r.total_ms, r.ops_per_sec, r.mean_ns, r.rsd, r.p50, r.p99, r.p999, r.max);
+        }
+#ifdef BENCH_STATS
+        printf("\nper operation:\n%-12s", "op");
+        for (auto &f : stat_fields) printf(" %10s", f.name);
+        printf("\n");
+        for (auto &r : rows) {
+            printf("%-12s", r.op.c_str());
+            for (double v : r.stats) printf(" %10.3f", v);
+            printf("\n");
+        }
+#endif
+    }
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n M] [-c copies] [-r reps] [-w warmup] [-s seed] [-t trace] "
+                    "[-f table|csv|json] [-b backend-name] [--no-header]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--no-header") {
+            opt.header = false;
+            continue;
+        }
+        if (i + 1 >= argc) usage(argv[0]);
+        const char *v = argv[++i];
+        if (a == "-n") opt.m = std::strtoul(v, nullptr, 10);
+        else if (a == "-c") opt.copies = std::atoi(v);
+        else if (a == "-r") opt.reps = std::atoi(v);
+        else if (a == "-w") opt.warmup = std::atoi(v);
+        else if (a == "-s") opt.seed = std::strtoul(v, nullptr, 10);
+        else if (a == "-t") opt.trace = v;
+        else if (a == "-f") opt.format = v;
+        else if (a == "-b") opt.backend = v;
+        else usage(argv[0]);
+    }
+    if (!opt.m || opt.reps <= 0) usage(argv[0]);
+
+    Recorder rec;
+    if (!opt.trace.empty()) {
+        size_t sets;
+        std::vector<Op> ops = readTrace(opt.trace, sets);
+        unsigned long long check = 0;
+        for (int i = 0; i < opt.warmup; i++) check = runTrace(ops, sets, rec);
+        rec.setActive(true);
+        for (int i = 0; i < opt.reps; i++) {
+            rec.beginRep();
+            check = runTrace(ops, sets, rec);
+        }
+        // Lets different backends be checked against each other on the same trace.
+        fprintf(stderr, "%s: %s checksum %llu\n", opt.backend.c_str(), opt.trace.c_str(), check);
+    } else {
+        for (int i = 0; i < opt.warmup; i++) runSpeed(opt, opt.seed + i, rec);
+        rec.setActive(true);
+        // Every backend sees the same sequence of seeds.
+        for (int i = 0; i < opt.reps; i++) {
+            rec.beginRep();
+            runSpeed(opt, opt.seed + opt.warmup + i, rec);
+        }
+    }
+
+    std::vector<Row> rows;
+    for (auto &s : rec.result()) rows.push_back(summarize(s));
+    print(opt, rows, rec.clockOverhead());
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+Workload generator for ESet-Speedtest style op streams.
+
+The output uses the same format as test/1.in, which treap/1.cpp (up to
+300000 sets) and `bench -t` read. Each copy op makes a new set, and
+test/1.cpp only has 25 of them, so it can only replay streams with fewer
+than 25 copies (N times the copy rate), not the default ones.
+
+    0 a k      emplace k into set a
+    1 a k      erase k from set a
+    2 a        s[++lst] = s[a]
+    3 a k      find k in set a
+    4 a l r    range(l, r) on set a
+    5          --it
+    6          ++it
+
+The default mix is the one README gives for ESet-Speedtest: N/2 emplace,
+N/6 erase, N/9 find, N/100 copy, N/18 range, iterator steps for the rest.
+
+Usage: gen [-n N] [-m universe] [-d uniform|zipf|asc|desc|adversarial]
+           [-z theta] [-v versions] [-c copy-rate] [-h hit-rate]
+           [-w range-width] [-s seed] [-o file]
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+struct Options {
+    long long n = 5000000;
+    long long m = 1000000;
+    std::string dist = "uniform";
+    double theta = 0.99;
+    long long versions = 25;
+    double copy_rate = 1.0 / 100;
+    double hit_rate = 0.5;
+    long long width = 1000;
+    unsigned long long seed = 1;
+    const char *out = nullptr;
+};
+
+/*
+Zipfian ranks in [0, n), following Gray et al., "Quickly Generating
+Billion-Record Synthetic Databases". Rank 0 is the most popular one.
+*/
+class Zipf {
+private:
+    long long n;
+    double theta, alpha, zetan, eta;
+
+    static double zeta(long long n, double theta) {
+        double s = 0;
+        for (long long i = 1; i <= n; i++) s += 1.0 / std::pow((double)i, theta);
+        return s;
+    }
+
+public:
+    Zipf(long long n, double theta) : n(n), theta(theta) {
+        zetan = zeta(n, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / zetan);
+    }
+
+    template <class Gen>
+    long long operator()(Gen &gen) {
+        double u = std::uniform_real_distribution<double>(0, 1)(gen);
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta)) return 1;
+        long long r = (long long)(n * std::pow(eta * u - eta + 1, alpha));
+        return r < n ? r : n - 1;
+    }
+};
+
+class Generator {
+private:
+    Options opt;
+    std::mt19937_64 gen;
+    Zipf *zipf;
+    long long counter;
+    // Keys that have been emplaced, so that erase/find can be made to hit.
+    std::vector<long long> seen;
+
+    long long uniform(long long lo, long long hi) {
+        return std::uniform_int_distribution<long long>(lo, hi)(gen);
+    }
+
+    // Spread the popular zipf ranks over the key space instead of 0, 1, 2...
+    long long scatter(long long r) const {
+        unsigned long long x = (unsigned long long)r * 0x9E3779B97F4A7C15ULL;
+        return (long long)(x % (unsigned long long)opt.m);
+    }
+
+public:
+    Generator(const Options &opt) : opt(opt), gen(opt.seed), zipf(nullptr), counter(0) {
+        if (opt.dist == "zipf") zipf = new Zipf(opt.m, opt.theta);
+    }
+
+    ~Generator() {
+        delete zipf;
+    }
+
+    // Key for an emplace.
+    long long fresh() {
+        long long k;
+        if (opt.dist == "asc") {
+            k = counter % opt.m;
+        } else if (opt.dist == "desc") {
+            k = opt.m - 1 - counter % opt.m;
+        } else if (opt.dist == "adversarial") {
+            // Zig-zag from both ends towards the middle: every insert lands on
+            // the far end of a spine, which is the worst case for rebalancing.
+            long long i = counter % opt.m;
+            k = i & 1 ? opt.m - 1 - i / 2 : i / 2;
+        } else if (zipf) {
+            k = scatter((*zipf)(gen));
+        } else {
+            k = uniform(0, opt.m - 1);
+        }
+        counter++;
+        seen.push_back(k);
+        return k;
+    }
+
+    // Key for erase/find/range: a previously emplaced one with probability hit_rate.
+    long long query() {
+        if (!seen.empty() && std::uniform_real_distribution<double>(0, 1)(gen) < opt.hit_rate) {
+            if (opt.dist == "asc" || opt.dist == "desc" || opt.dist == "adversarial") {
+                // Monotone workloads mostly touch what was inserted recently.
+                long long back = std::min<long long>(seen.size(), 64);
+                return seen[seen.size() - 1 - uniform(0, back - 1)];
+            }
+            return seen[uniform(0, seen.size() - 1)];
+        }
+        if (zipf) return scatter((*zipf)(gen));
+        return uniform(0, opt.m - 1);
+    }
+
+    void run(FILE *f) {
+        // Cumulative weights: emplace, erase, find, copy, range, iterator.
+        const double w[] = {1.0 / 2, 1.0 / 6, 1.0 / 9, opt.copy_rate, 1.0 / 18};
+        long long lst = 0;
+        for (long long i = 0; i < opt.n; i++) {
+            double u = std::uniform_real_distribution<double>(0, 1)(gen);
+            // Operations are spread over the `versions` most recent sets.
+            long long a = uniform(std::max(0LL, lst - opt.versions + 1), lst);
+            if ((u -= w[0]) < 0) {
+                fprintf(f, "0 %lld %lld\n", a, fresh());
+            } else if ((u -= w[1]) < 0) {
+                fprintf(f, "1 %lld %lld\n", a, query());
+            } else if ((u -= w[2]) < 0) {
+                fprintf(f, "3 %lld %lld\n", a, query());
+            } else if ((u -= w[3]) < 0) {
+                fprintf(f, "2 %lld\n", a);
+                lst++;
+            } else if ((u -= w[4]) < 0) {
+                long long l = query();
+                fprintf(f, "4 %lld %lld %lld\n", a, l, l + uniform(0, opt.width));
+            } else {
+                fprintf(f, "%d\n", uniform(0, 1) ? 5 : 6);
+            }
+        }
+    }
+};
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n N] [-m universe] [-d uniform|zipf|asc|desc|adversarial] "
+                    "[-z theta] [-v versions] [-c copy-rate] [-h hit-rate] [-w range-width] "
+                    "[-s seed] [-o file]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) usage(argv[0]);
+        std::string a = argv[i];
+        const char *v = argv[++i];
+        if (a == "-n") opt.n = std::atoll(v);
+        else if (a == "-m") opt.m = std::atoll(v);
+        else if (a == "-d") opt.dist = v;
+        else if (a == "-z") opt.theta = std::atof(v);
+        else if (a == "-v") opt.versions = std::atoll(v);
+        else if (a == "-c") opt.copy_rate = std::atof(v);
+        else if (a == "-h") opt.hit_rate = std::atof(v);
+        else if (a == "-w") opt.width = std::atoll(v);
+        else if (a == "-s") opt.seed = std::strtoull(v, nullptr, 10);
+        else if (a == "-o") opt.out = v;
+        else usage(argv[0]);
+    }
+    if (opt.n < 0 || opt.m <= 0 || opt.versions <= 0 || opt.width < 0) usage(argv[0]);
+    if (opt.dist != "uniform" && opt.dist != "zipf" && opt.dist != "asc"
+        && opt.dist != "desc" && opt.dist != "adversarial") usage(argv[0]);
+    if (opt.dist == "zipf" && (opt.theta <= 0 || opt.theta >= 1)) usage(argv[0]);
+
+    FILE *f = opt.out ? fopen(opt.out, "w") : stdout;
+    if (!f) {
+        perror(opt.out);
+        return 1;
+    }
+    Generator(opt).run(f);
+    if (f != stdout) fclose(f);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Build bench.cpp once per backend and run them all with the same arguments.
+# Extra arguments are passed to every run, e.g.  ./run.sh -f csv -r 10
+# Set BACKENDS to pick a subset (a "-persistent" suffix, e.g. rbtree-persistent,
+# builds the persistent mode of that backend), CXX/CXXFLAGS to change the compiler and
+# STATS=1 to build with the structural-work counters.
+
+set -e
+
+cd "$(dirname "$0")"
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2 -std=c++17}
+BACKENDS=${BACKENDS:-"std rbtree avl splay treap bplus skiplist trie art"}
+OUT=${OUT:-build}
+if [ -n "$STATS" ]; then
+    CXXFLAGS="$CXXFLAGS -DESET_STATS"
+fi
+case $OUT in /*) ;; *) OUT=./$OUT ;; esac
+
+mkdir -p "$OUT"
+header=""
+for b in $BACKENDS; do
+    if [ "$b" = std ]; then
+        $CXX $CXXFLAGS -DBENCH_STD_SET -DBENCH_BACKEND='"std::set"' bench.cpp -o "$OUT/bench_$b"
+    elif [ "${b%-persistent}" != "$b" ]; then
+        $CXX $CXXFLAGS -I"../${b%-persistent}" -DBENCH_PERSISTENT -DBENCH_BACKEND="\"$b\"" bench.cpp -o "$OUT/bench_$b"
+    else
+        $CXX $CXXFLAGS -I"../$b" -DBENCH_BACKEND="\"$b\"" bench.cpp -o "$OUT/bench_$b"
+    fi
+    "$OUT/bench_$b" $header "$@"
+    # Only the first run prints the CSV header.
+    header="--no-header"
+done
@@ -0,0 +1,986 @@
+#ifndef ESET_BPLUS_HPP
+#define ESET_BPLUS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus > 201703L
+#include <compare>
+#endif
+
+#ifdef DEBUG
+#include <iostream>
+#include <string>
+#endif
+
+#include "../common/eset_common.hpp"
+
+namespace eset::bplus {
+
+/*
+In-memory B+ tree. Keys are kept in the leaves, which are linked in order,
+and each inner node stores, next to every child, the number of keys below
+it, for range, nth and rank. A leaf's keys fill about four cache lines and an
+inner node, with its child pointers and counts, is around 1.3 KB, so a
+search reads one node per level.
+
+Every key sits in an Item that does not move while the key is in the set:
+iterators and references stay valid across other inserts and erases, as
+with the other backends. Leaves point to the items and, for arithmetic keys,
+keep a copy of the keys next to the pointers. With std::less such a node is
+searched by counting the keys below the target over the whole node, a loop
+of fixed length the compiler turns into SIMD compares. That takes keys of up
+to 32 bits at -O2 on x86-64, or 64 bits with -msse4.2 or -march=native;
+wider keys are binary searched like the rest.
+*/
+template <typename Key, typename Compare = std::less<Key>>
+class ESet {
+private:
+    static constexpr bool INLINE = std::is_arithmetic<Key>::value;
+
+    // Widest key the counting loop is vectorized for: x86 has packed 64-bit compares from SSE4.2 on.
+#if defined(__SSE4_2__) || defined(__aarch64__)
+    static constexpr size_t VECTOR_KEY = 8;
+#else
+    static constexpr size_t VECTOR_KEY = 4;
+#endif
+    static constexpr bool SIMD = INLINE && sizeof(Key) <= VECTOR_KEY
+        && (std::is_same<Compare, std::less<Key>>::value || std::is_same<Compare, std::less<>>::value);
+
+    // Keys per node: four cache lines of them, but no fewer than 8 and no more than 64.
+    static constexpr int capacity(size_t bytes) {
+        return 256 / bytes < 8 ? 8 : 256 / bytes > 64 ? 64 : int(256 / bytes);
+    }
+
+    static constexpr int LEAF = capacity(INLINE ? sizeof(Key) : sizeof(void*));
+    static constexpr int INNER = capacity(sizeof(Key));
+    static constexpr int MAX_DEPTH = 64;
+
+    struct Leaf;
+
+    struct Item {
+        Key key;
+        Leaf *leaf;
+        int slot;
+
+        template <class... Args>
+        explicit Item(Args &&... args) : key(std::forward<Args>(args)...) {}
+    };
+
+    // A separator that is constructed and destroyed by hand.
+    struct Slot {
+        union {
+            Key key;
+        };
+
+        Slot() {}
+        ~Slot() {}
+    };
+
+    struct Node {
+        int n;      // keys of a leaf, children of an inner node
+        bool leaf;
+    };
+
+    struct Leaf : Node {
+        Leaf *prev, *next;
+        Item *items[LEAF];
+        typename std::conditional<INLINE, Key[LEAF], char>::type keys;
+    };
+
+    struct Inner : Node {
+        typename std::conditional<INLINE, Key, Slot>::type seps[INNER - 1];
+        Node *child[INNER];
+        size_t cnt[INNER];
+    };
+
+    class ItemPool {
+    private:
+        static constexpr size_t MIN_CHUNK = 32, MAX_CHUNK = 1 << 16;
+
+        struct Free {
+            Free *next;
+        };
+
+        std::vector<std::pair<Item*, size_t>> chunks;
+        Free *freed;
+        Item *cur;
+        size_t left, total;
+
+        void grow(size_t n) {
+            Item *chunk = std::allocator<Item>().allocate(n);
+            chunks.emplace_back(chunk, n);
+            cur = chunk;
+            left = n;
+            total += n;
+        }
+
+    public:
+        ItemPool() : freed{nullptr}, cur{nullptr}, left{0}, total{0} {}
+
+        ItemPool(const ItemPool &) = delete;
+        ItemPool& operator=(const ItemPool &) = delete;
+
+        ~ItemPool() {
+            clear();
+        }
+
+        // Raw storage, to be constructed by the caller.
+        void* allocate() {
+            if (freed) {
+                void *x = freed;
+                freed = freed->next;
+                return x;
+            }
+            if (!left) grow(total < MIN_CHUNK ? MIN_CHUNK : total < MAX_CHUNK ? total : MAX_CHUNK);
+            left--;
+            return cur++;
+        }
+
+        void reserve(size_t n) {
+            if (left < n) grow(n);
+        }
+
+        // The item must already be destroyed.
+        void deallocate(Item *x) {
+            freed = new (static_cast<void*>(x)) Free{freed};
+        }
+
+        void clear() {
+            for (auto &c : chunks) std::allocator<Item>().deallocate(c.first, c.second);
+            chunks.clear();
+            freed = nullptr;
+            cur = nullptr;
+            left = total = 0;
+        }
+
+        void swap(ItemPool &other) {
+            chunks.swap(other.chunks);
+            std::swap(freed, other.freed);
+            std::swap(cur, other.cur);
+            std::swap(left, other.left);
+            std::swap(total, other.total);
+        }
+    };
+
+    Node *root;
+    Leaf *head, *tail;
+    size_t total;
+    ItemPool pool;
+    ESET_COMPARE(Compare) cmp;
+
+    // What unused key slots hold, so that counting over a whole node skips them.
+    static Key pad() {
+        if constexpr (std::numeric_limits<Key>::has_infinity) return std::numeric_limits<Key>::infinity();
+        else return std::numeric_limits<Key>::max();
+    }
+
+    static Leaf* asLeaf(Node *x) { return static_cast<Leaf*>(x); }
+    static const Leaf* asLeaf(const Node *x) { return static_cast<const Leaf*>(x); }
+    static Inner* asInner(Node *x) { return static_cast<Inner*>(x); }
+    static const Inner* asInner(const Node *x) { return static_cast<const Inner*>(x); }
+
+    static const Key& keyAt(const Leaf *x, int i) {
+        if constexpr (INLINE) return x->keys[i];
+        else return x->items[i]->key;
+    }
+
+    static const Key& sepAt(const Inner *x, int i) {
+        if constexpr (INLINE) return x->seps[i];
+        else return x->seps[i].key;
+    }
+
+    static Leaf* newLeaf() {
+        Leaf *x = new Leaf;
+        x->n = 0;
+        x->leaf = true;
+        x->prev = x->next = nullptr;
+        if constexpr (INLINE) std::fill(x->keys, x->keys + LEAF, pad());
+        return x;
+    }
+
+    static Inner* newInner() {
+        Inner *x = new Inner;
+        x->n = 0;
+        x->leaf = false;
+        if constexpr (INLINE) std::fill(x->seps, x->seps + INNER - 1, pad());
+        return x;
+    }
+
+    template <class... Args>
+    Item* newItem(Args &&... args) {
+        void *p = pool.allocate();
+        try {
+            return new (p) Item(std::forward<Args>(args)...);
+        } catch (...) {
+            pool.deallocate(static_cast<Item*>(p));
+            throw;
+        }
+    }
+
+    void dropItem(Item *x) {
+        x->~Item();
+        pool.deallocate(x);
+    }
+
+    // Frees the subtree of x, with its items when drop is set.
+    void release(Node *x, bool drop) {
+        if (x->leaf) {
+            Leaf *y = asLeaf(x);
+            if (drop) for (int i = 0; i < y->n; i++) dropItem(y->items[i]);
+            delete y;
+            return;
+        }
+        Inner *y = asInner(x);
+        for (int i = 0; i < y->n; i++) release(y->child[i], drop);
+        if constexpr (!INLINE) for (int i = 0; i + 1 < y->n; i++) y->seps[i].key.~Key();
+        delete y;
+    }
+
+    static size_t getSize(const Node *x) {
+        if (x->leaf) return x->n;
+        size_t s = 0;
+        for (int i = 0; i < x->n; i++) s += asInner(x)->cnt[i];
+        return s;
+    }
+
+    // Puts the entry y[j] at x[i], leaving y[j] unused.
+    static void moveEntry(Leaf *x, int i, Leaf *y, int j) {
+        Item *item = y->items[j];
+        x->items[i] = item;
+        item->leaf = x;
+        item->slot = i;
+        if constexpr (INLINE) {
+            x->keys[i] = y->keys[j];
+            if (x != y || i != j) y->keys[j] = pad();
+        }
+    }
+
+    static void setEntry(Leaf *x, int i, Item *item) {
+        x->items[i] = item;
+        item->leaf = x;
+        item->slot = i;
+        if constexpr (INLINE) x->keys[i] = item->key;
+    }
+
+    static void makeSep(Inner *x, int i, const Key &key) {
+        if constexpr (INLINE) x->seps[i] = key;
+        else new (&x->seps[i].key) Key(key);
+    }
+
+    static void setSep(Inner *x, int i, const Key &key) {
+        if constexpr (INLINE) x->seps[i] = key;
+        else x->seps[i].key = key;
+    }
+
+    static void dropSep(Inner *x, int i) {
+        if constexpr (INLINE) x->seps[i] = pad();
+        else x->seps[i].key.~Key();
+    }
+
+    // Puts the separator y[j] at the unused x[i], leaving y[j] unused.
+    static void moveSep(Inner *x, int i, Inner *y, int j) {
+        if constexpr (INLINE) {
+            x->seps[i] = y->seps[j];
+            y->seps[j] = pad();
+        } else {
+            new (&x->seps[i].key) Key(std::move(y->seps[j].key));
+            y->seps[j].key.~Key();
+        }
+    }
+
+    /*
+    Number of the first n of N keys that are below key, or not above it when
+    Upper is set. keys is the inline copy of the node's keys, if any.
+    */
+    template <bool Upper, int N, class K, class Get>
+    int countKeys(const Key *keys, int n, const K &key, Get get) const {
+        if constexpr (SIMD && std::is_same<K, Key>::value) {
+            int c = 0;
+            for (int i = 0; i < N; i++) c += Upper ? !(key < keys[i]) : keys[i] < key;
+            return c < n ? c : n;
+        } else {
+            int l = 0, r = n;
+            while (l < r) {
+                int m = (l + r) / 2;
+                if (Upper ? !cmp(key, get(m)) : cmp(get(m), key)) l = m + 1;
+                else r = m;
+            }
+            return l;
+        }
+    }
+
+    template <bool Upper, class K>
+    int countIn(const Leaf *x, const K &key) const {
+        const Key *keys = nullptr;
+        if constexpr (INLINE) keys = x->keys;
+        return countKeys<Upper, LEAF>(keys, x->n, key, [x](int i) -> const Key& { return keyAt(x, i); });
+    }
+
+    /*
+    The child of x to follow for key: the number of separators not above it.
+    Child i holds keys below separator i and not below separator i - 1.
+    */
+    template <class K>
+    int route(const Inner *x, const K &key) const {
+        const Key *seps = nullptr;
+        if constexpr (INLINE) seps = x->seps;
+        return countKeys<true, INNER - 1>(seps, x->n - 1, key, [x](int i) -> const Key& { return sepAt(x, i); });
+    }
+
+    template <class K>
+    const Leaf* findLeaf(const K &key) const {
+        ESET_COUNT(descents);
+        const Node *x = root;
+        for (; !x->leaf; x = asInner(x)->child[route(asInner(x), key)]) ESET_COUNT(visits);
+        ESET_COUNT(visits);
+        return asLeaf(x);
+    }
+
+    template <class K>
+    const Item* nfind(const K &key) const {
+        if (!root) return nullptr;
+        const Leaf *x = findLeaf(key);
+        int i = countIn<false>(x, key);
+        return i < x->n && !cmp(key, keyAt(x, i)) ? x->items[i] : nullptr;
+    }
+
+    // The first key above key, or not below it unless strict.
+    template <class K>
+    const Item* findAbove(const K &key, bool strict) const {
+        if (!root) return nullptr;
+        const Leaf *x = findLeaf(key);
+        int i = strict ? countIn<true>(x, key) : countIn<false>(x, key);
+        if (i < x->n) return x->items[i];
+        return x->next ? x->next->items[0] : nullptr;
+    }
+
+    static const Item* findNext(const Item *item) {
+        const Leaf *x = item->leaf;
+        if (item->slot + 1 < x->n) return x->items[item->slot + 1];
+        return x->next ? x->next->items[0] : nullptr;
+    }
+
+    static const Item* findPrev(const Item *item) {
+        const Leaf *x = item->leaf;
+        if (item->slot) return x->items[item->slot - 1];
+        return x->prev ? x->prev->items[x->prev->n - 1] : nullptr;
+    }
+
+    const Item* findNth(size_t k) const {
+        if (k >= total) return nullptr;
+        ESET_COUNT(descents);
+        const Node *x = root;
+        for (; !x->leaf; ) {
+            ESET_COUNT(visits);
+            const Inner *y = asInner(x);
+            int i = 0;
+            for (; k >= y->cnt[i]; i++) k -= y->cnt[i];
+            x = y->child[i];
+        }
+        ESET_COUNT(visits);
+        return asLeaf(x)->items[k];
+    }
+
+    // Keys of the subtree of x below key, or not above it when Upper is set.
+    template <bool Upper, class K>
+    size_t countBelow(const Node *x, const K &key) const {
+        size_t c = 0;
+        for (; !x->leaf; ) {
+            ESET_COUNT(visits);
+            const Inner *y = asInner(x);
+            int j = route(y, key);
+            for (int i = 0; i < j; i++) c += y->cnt[i];
+            x = y->child[j];
+        }
+        ESET_COUNT(visits);
+        return c + countIn<Upper>(asLeaf(x), key);
+    }
+
+    template <class K>
+    size_t position(const K &key) const {
+        if (!root) return 0;
+        ESET_COUNT(descents);
+        return countBelow<false>(root, key);
+    }
+
+    static void insertEntry(Leaf *x, int i, Item *item) {
+        for (int j = x->n; j > i; j--) moveEntry(x, j, x, j - 1);
+        setEntry(x, i, item);
+        x->n++;
+    }
+
+    static void eraseEntry(Leaf *x, int i) {
+        for (int j = i; j + 1 < x->n; j++) moveEntry(x, j, x, j + 1);
+        x->n--;
+        if constexpr (INLINE) x->keys[x->n] = pad();
+    }
+
+    // Makes y child i of x, i > 0, with key as the separator in front of it.
+    static void insertChild(Inner *x, int i, Node *y, size_t cnt, const Key &key) {
+        for (int j = x->n; j > i; j--) {
+            x->child[j] = x->child[j - 1];
+            x->cnt[j] = x->cnt[j - 1];
+            moveSep(x, j - 1, x, j - 2);
+        }
+        x->child[i] = y;
+        x->cnt[i] = cnt;
+        makeSep(x, i - 1, key);
+        x->n++;
+    }
+
+    // Drops child i of x, i > 0, and the separator in front of it.
+    static void eraseChild(Inner *x, int i) {
+        dropSep(x, i - 1);
+        for (int j = i; j + 1 < x->n; j++) {
+            x->child[j] = x->child[j + 1];
+            x->cnt[j] = x->cnt[j + 1];
+            moveSep(x, j - 1, x, j);
+        }
+        x->n--;
+    }
+
+    // Moves the upper half of the full leaf x to a new leaf after it.
+    Leaf* splitLeaf(Leaf *x) {
+        Leaf *y = newLeaf();
+        int h = LEAF / 2;
+        for (int i = h; i < LEAF; i++) moveEntry(y, i - h, x, i);
+        y->n = LEAF - h;
+        x->n = h;
+        y->prev = x;
+        y->next = x->next;
+        if (y->next) y->next->prev = y;
+        else tail = y;
+        x->next = y;
+        return y;
+    }
+
+    // Moves the upper half of the full inner node x to a new node.
+    static Inner* splitInner(Inner *x) {
+        Inner *y = newInner();
+        int h = INNER / 2;
+        for (int i = h; i < INNER; i++) {
+            y->child[i - h] = x->child[i];
+            y->cnt[i - h] = x->cnt[i];
+        }
+        for (int i = h; i < INNER - 1; i++) moveSep(y, i - h, x, i);
+        dropSep(x, h - 1);
+        y->n = INNER - h;
+        x->n = h;
+        return y;
+    }
+
+    static const Key& minKey(const Node *x) {
+        for (; !x->leaf; x = asInner(x)->child[0]);
+        return asLeaf(x)->items[0]->key;
+    }
+
+    /*
+    Adds item at slot i of the leaf at the end of path. A full node splits in
+    two and hands the new half to its parent, with the smallest key under it
+    as the separator; the counts along the path grow by one.
+    */
+    void insert(Inner **path, int *idx, int d, Leaf *x, int i, Item *item) {
+        Node *extra = nullptr;
+        if (x->n < LEAF) {
+            insertEntry(x, i, item);
+        } else {
+            Leaf *y = splitLeaf(x);
+            if (i <= x->n) insertEntry(x, i, item);
+            else insertEntry(y, i - x->n, item);
+            extra = y;
+        }
+        for (; d--; ) {
+            Inner *p = path[d];
+            int j = idx[d];
+            if (!extra) {
+                p->cnt[j]++;
+                continue;
+            }
+            p->cnt[j] = getSize(p->child[j]);
+            size_t c = getSize(extra);
+            const Key &key = minKey(extra);
+            if (p->n < INNER) {
+                insertChild(p, j + 1, extra, c, key);
+                extra = nullptr;
+            } else {
+                Inner *q = splitInner(p);
+                if (j + 1 <= p->n) insertChild(p, j + 1, extra, c, key);
+                else insertChild(q, j + 1 - p->n, extra, c, key);
+                extra = q;
+            }
+        }
+        if (extra) {
+            Inner *r = newInner();
+            r->child[0] = root;
+            r->cnt[0] = getSize(root);
+            r->n = 1;
+            insertChild(r, 1, extra, getSize(extra), minKey(extra));
+            root = r;
+        }
+        total++;
+    }
+
+    /*
+    Refills child j of p, which fell below half, from a sibling: by taking a
+    key or child when the sibling can spare one, by merging the two otherwise.
+    */
+    void fixLeaf(Inner *p, int j) {
+        Leaf *x = asLeaf(p->child[j]);
+        if (j > 0) {
+            Leaf *y = asLeaf(p->child[j - 1]);
+            if (y->n > LEAF / 2) {
+                insertEntry(x, 0, y->items[y->n - 1]);
+                y->n--;
+                if constexpr (INLINE) y->keys[y->n] = pad();
+                p->cnt[j - 1]--;
+                p->cnt[j]++;
+                setSep(p, j - 1, x->items[0]->key);
+                return;
+            }
+            for (int i = 0; i < x->n; i++) moveEntry(y, y->n + i, x, i);
+            y->n += x->n;
+            unlinkLeaf(x);
+            p->cnt[j - 1] += p->cnt[j];
+            eraseChild(p, j);
+        } else {
+            Leaf *y = asLeaf(p->child[j + 1]);
+            if (y->n > LEAF / 2) {
+                moveEntry(x, x->n++, y, 0);
+                eraseEntry(y, 0);
+                p->cnt[j]++;
+                p->cnt[j + 1]--;
+                setSep(p, j, y->items[0]->key);
+                return;
+            }
+            for (int i = 0; i < y->n; i++) moveEntry(x, x->n + i, y, i);
+            x->n += y->n;
+            unlinkLeaf(y);
+            p->cnt[j] += p->cnt[j + 1];
+            eraseChild(p, j + 1);
+        }
+    }
+
+    void unlinkLeaf(Leaf *x) {
+        x->prev->next = x->next;
+        if (x->next) x->next->prev = x->prev;
+        else tail = x->prev;
+        delete x;
+    }
+
+    // Appends y, and the separator of p in front of it, to x, its left neighbour.
+    static void mergeInner(Inner *p, int j, Inner *x, Inner *y) {
+        makeSep(x, x->n - 1, sepAt(p, j));
+        for (int i = 0; i < y->n; i++) {
+            x->child[x->n + i] = y->child[i];
+            x->cnt[x->n + i] = y->cnt[i];
+        }
+        for (int i = 0; i + 1 < y->n; i++) moveSep(x, x->n + i, y, i);
+        x->n += y->n;
+        y->n = 0;
+        delete y;
+        p->cnt[j] += p->cnt[j + 1];
+        eraseChild(p, j + 1);
+    }
+
+    static void fixInner(Inner *p, int j) {
+        Inner *x = asInner(p->child[j]);
+        if (j > 0) {
+            Inner *y = asInner(p->child[j - 1]);
+            if (y->n > INNER / 2) {
+                for (int i = x->n; i > 0; i--) {
+                    x->child[i] = x->child[i - 1];
+                    x->cnt[i] = x->cnt[i - 1];
+                }
+                for (int i = x->n - 1; i > 0; i--) moveSep(x, i, x, i - 1);
+                x->child[0] = y->child[y->n - 1];
+                x->cnt[0] = y->cnt[y->n - 1];
+                moveSep(x, 0, p, j - 1);
+                moveSep(p, j - 1, y, y->n - 2);
+                x->n++;
+                y->n--;
+                p->cnt[j - 1] -= x->cnt[0];
+                p->cnt[j] += x->cnt[0];
+                return;
+            }
+            mergeInner(p, j - 1, y, x);
+        } else {
+            Inner *y = asInner(p->child[j + 1]);
+            if (y->n > INNER / 2) {
+                x->child[x->n] = y->child[0];
+                x->cnt[x->n] = y->cnt[0];
+                moveSep(x, x->n - 1, p, j);
+                moveSep(p, j, y, 0);
+                x->n++;
+                p->cnt[j] += y->cnt[0];
+                p->cnt[j + 1] -= y->cnt[0];
+                for (int i = 0; i + 1 < y->n; i++) {
+                    y->child[i] = y->child[i + 1];
+                    y->cnt[i] = y->cnt[i + 1];
+                }
+                for (int i = 0; i + 2 < y->n; i++) moveSep(y, i, y, i + 1);
+                y->n--;
+                return;
+            }
+            mergeInner(p, j, x, y);
+        }
+    }
+
+    Node* clone(const Node *x, Leaf *&last) {
+        if (x->leaf) {
+            const Leaf *y = asLeaf(x);
+            Leaf *z = newLeaf();
+            for (int i = 0; i < y->n; i++) setEntry(z, i, newItem(y->items[i]->key));
+            z->n = y->n;
+            z->prev = last;
+            if (last) last->next = z;
+            else head = z;
+            return last = z;
+        }
+        const Inner *y = asInner(x);
+        Inner *z = newInner();
+        for (int i = 0; i < y->n; i++) {
+            z->child[i] = clone(y->child[i], last);
+            z->cnt[i] = y->cnt[i];
+            if (i) makeSep(z, i - 1, sepAt(y, i - 1));
+            z->n = i + 1;
+        }
+        return z;
+    }
+
+    void copyFrom(const ESet &other) {
+        if (!other.root) return;
+        pool.reserve(other.total);
+        Leaf *last = nullptr;
+        root = clone(other.root, last);
+        tail = last;
+        total = other.total;
+    }
+
+    #ifdef DEBUG
+    void debug_print(const Node *x, int depth) const {
+        std::cerr << std::string(depth * 2, ' ');
+        if (x->leaf) {
+            for (int i = 0; i < x->n; i++) std::cerr << keyAt(asLeaf(x), i) << " ";
+            std::cerr << "\n";
+            return;
+        }
+        const Inner *y = asInner(x);
+        std::cerr << "inner, size: " << getSize(x) << ", separators:";
+        for (int i = 0; i + 1 < y->n; i++) std::cerr << " " << sepAt(y, i);
+        std::cerr << "\n";
+        for (int i = 0; i < y->n; i++) debug_print(y->child[i], depth + 1);
+    }
+    #endif
+
+public:
+    class iterator {
+        friend class ESet;
+    private:
+        const ESet *from;
+        const Item *item;
+
+        iterator(const Item *item, const ESet *from) : from{from}, item{item} {}
+
+    public:
+        iterator() : from{nullptr}, item{nullptr} {}
+
+        const Key& operator*() const {
+            if (!item) throw std::out_of_range("Out of range");
+            return item->key;
+        }
+
+        const Key* operator->() const {
+            if (!item) throw std::out_of_range("Out of range");
+            return &item->key;
+        }
+
+        // Within a leaf or on to the next one, O(1).
+        iterator& operator++() {
+            if (item) item = findNext(item);
+            return *this;
+        }
+
+        iterator& operator--() {
+            if (!from) return *this;
+            const Item *tmp = item ? findPrev(item) : from->tail ? from->tail->items[from->tail->n - 1] : nullptr;
+            if (tmp) item = tmp;
+            return *this;
+        }
+
+        // Moves k positions in O(log n), stopping at begin() or end().
+        iterator& operator+=(std::ptrdiff_t k) {
+            if (!from) return *this;
+            size_t i = item ? from->position(item->key) : from->size();
+            if (k < 0) i = size_t(-k) < i ? i + k : 0;
+            else i += k;
+            item = from->findNth(i);
+            return *this;
+        }
+
+        iterator& operator-=(std::ptrdiff_t k) {
+            return *this += -k;
+        }
+
+        iterator operator+(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp += k;
+        }
+
+        iterator operator-(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp -= k;
+        }
+
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        iterator operator--(int) {
+            iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const iterator &other) const {
+            return from == other.from && item == other.item;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return from != other.from || item != other.item;
+        }
+    };
+
+    ESet() : root{nullptr}, head{nullptr}, tail{nullptr}, total{0} {}
+
+    ~ESet() {
+        clear();
+    }
+
+    ESet(const ESet &other) : root{nullptr}, head{nullptr}, tail{nullptr}, total{0}, cmp{other.cmp} {
+        copyFrom(other);
+    }
+
+    ESet& operator=(const ESet &other) {
+        if (&other == this) return *this;
+        clear();
+        copyFrom(other);
+        return *this;
+    }
+
+    ESet(ESet &&other) noexcept : root{other.root}, head{other.head}, tail{other.tail}, total{other.total} {
+        pool.swap(other.pool);
+        other.root = nullptr;
+        other.head = other.tail = nullptr;
+        other.total = 0;
+    }
+
+    ESet& operator=(ESet &&other) noexcept {
+        if (&other == this) return *this;
+        clear();
+        std::swap(root, other.root);
+        std::swap(head, other.head);
+        std::swap(tail, other.tail);
+        std::swap(total, other.total);
+        pool.swap(other.pool);
+        return *this;
+    }
+
+private:
+    template <class K>
+    std::pair<iterator, bool> emplaceKey(std::true_type, K &&key) {
+        if (!root) {
+            Item *item = newItem(std::forward<K>(key));
+            Leaf *x = newLeaf();
+            setEntry(x, 0, item);
+            x->n = 1;
+            root = head = tail = x;
+            total = 1;
+            return std::make_pair(iterator(item, this), true);
+        }
+        Inner *path[MAX_DEPTH];
+        int idx[MAX_DEPTH], d = 0;
+        ESET_COUNT(descents);
+        Node *x = root;
+        for (; !x->leaf; d++) {
+            ESET_COUNT(visits);
+            path[d] = asInner(x);
+            idx[d] = route(path[d], key);
+            x = path[d]->child[idx[d]];
+        }
+        ESET_COUNT(visits);
+        Leaf *y = asLeaf(x);
+        int i = countIn<false>(y, key);
+        if (i < y->n && !cmp(key, keyAt(y, i))) return std::make_pair(iterator(y->items[i], this), false);
+        Item *item = newItem(std::forward<K>(key));
+        insert(path, idx, d, y, i, item);
+        return std::make_pair(iterator(item, this), true);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplaceKey(std::false_type, Args &&... args) {
+        Key key(std::forward<Args>(args)...);
+        return emplaceKey(std::true_type(), std::move(key));
+    }
+
+public:
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        return emplaceKey(ESetEmplaceLookup<Compare, Key, Args...>(), std::forward<Args>(args)...);
+    }
+
+    size_t erase(const Key &key) {
+        return erase<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t erase(const K &key) {
+        if (!root) return 0;
+        Inner *path[MAX_DEPTH];
+        int idx[MAX_DEPTH], d = 0;
+        ESET_COUNT(descents);
+        Node *x = root;
+        for (; !x->leaf; d++) {
+            ESET_COUNT(visits);
+            path[d] = asInner(x);
+            idx[d] = route(path[d], key);
+            x = path[d]->child[idx[d]];
+        }
+        ESET_COUNT(visits);
+        Leaf *y = asLeaf(x);
+        int i = countIn<false>(y, key);
+        if (i == y->n || cmp(key, keyAt(y, i))) return 0;
+        dropItem(y->items[i]);
+        eraseEntry(y, i);
+        total--;
+        for (int t = 0; t < d; t++) path[t]->cnt[idx[t]]--;
+        // Fix nodes that fell below half full, from the leaf up.
+        if (d && y->n < LEAF / 2) {
+            fixLeaf(path[d - 1], idx[d - 1]);
+            for (int t = d - 1; t > 0 && path[t]->n < INNER / 2; t--) fixInner(path[t - 1], idx[t - 1]);
+        }
+        if (!root->leaf && root->n == 1) {
+            Inner *r = asInner(root);
+            root = r->child[0];
+            delete r;
+        } else if (root->leaf && !root->n) {
+            delete asLeaf(root);
+            root = head = tail = nullptr;
+        }
+        return 1;
+    }
+
+    iterator find(const Key &key) const {
+        return find<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator find(const K &key) const {
+        return iterator(nfind(key), this);
+    }
+
+    void clear() noexcept {
+        if (root) release(root, !std::is_trivially_destructible<Key>::value);
+        pool.clear();
+        root = nullptr;
+        head = tail = nullptr;
+        total = 0;
+    }
+
+    size_t range(const Key &l, const Key &r) const {
+        return range<Key>(l, r);
+    }
+
+    // Descends together until the routes to l and r part, then counts along each.
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t range(const K &l, const K &r) const {
+        if (!root || cmp(r, l)) return 0;
+        ESET_COUNT(descents);
+        const Node *x = root;
+        for (; !x->leaf; ) {
+            ESET_COUNT(visits);
+            const Inner *y = asInner(x);
+            int i = route(y, l), j = route(y, r);
+            if (i == j) {
+                x = y->child[i];
+                continue;
+            }
+            size_t c = y->cnt[i] - countBelow<false>(y->child[i], l);
+            for (int k = i + 1; k < j; k++) c += y->cnt[k];
+            return c + countBelow<true>(y->child[j], r);
+        }
+        ESET_COUNT(visits);
+        return countIn<true>(asLeaf(x), r) - countIn<false>(asLeaf(x), l);
+    }
+
+    // The k-th smallest key, counting from 0, or end() if k >= size().
+    iterator nth(size_t k) const {
+        return iterator(findNth(k), this);
+    }
+
+    // Number of keys less than key.
+    size_t rank(const Key &key) const {
+        return position(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t rank(const K &key) const {
+        return position(key);
+    }
+
+    size_t size() const noexcept {
+        return total;
+    }
+
+    iterator lower_bound(const Key &key) const {
+        return iterator(findAbove(key, false), this);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator lower_bound(const K &key) const {
+        return iterator(findAbove(key, false), this);
+    }
+
+    iterator upper_bound(const Key &key) const {
+        return iterator(findAbove(key, true), this);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator upper_bound(const K &key) const {
+        return iterator(findAbove(key, true), this);
+    }
+
+    iterator begin() const noexcept {
+        return iterator(head ? head->items[0] : nullptr, this);
+    }
+
+    iterator end() const noexcept {
+        return iterator(nullptr, this);
+    }
+
+    #ifdef DEBUG
+    void debug_print() const {
+        if (root) debug_print(root, 0);
+    }
+    #endif
+};
+
+} // namespace eset::bplus
+
+#if !defined(ESET_NO_GLOBAL) && !defined(ESET_GLOBAL_DEFINED)
+#define ESET_GLOBAL_DEFINED
+template <class Key, class Compare = std::less<Key>>
+using ESet = eset::bplus::ESet<Key, Compare>;
+#endif
+
+#endif // ESET_BPLUS_HPP
@@ -0,0 +1,404 @@
+#ifndef ESET_BST_HPP
+#define ESET_BST_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+#include "eset_common.hpp"
+#include "node_pool.hpp"
+
+/*
+What the red-black and AVL trees share: a binary search tree with parent
+pointers, subtree sizes and a nil sentinel, and everything on it that does
+not depend on how it is balanced. Node needs s[2], fa, size, key and
+link(); Derived, the set itself, supplies cloneNode() for clone() and the
+updates (emplace, erase, copying, debug output).
+*/
+template <class Derived, class Node, class Key, class Compare>
+class ESetTree {
+    friend Derived;
+
+protected:
+    Node *root, *nil;
+    ESetNodePool<Node> pool;
+    ESET_COMPARE(Compare) cmp;
+
+    ESetTree() : root{nullptr}, nil{new Node} {
+        root = nil;
+    }
+
+    // Only the comparator: Derived clones the tree once it is constructed.
+    ESetTree(const ESetTree &other) : root{nullptr}, nil{new Node}, cmp{other.cmp} {
+        root = nil;
+    }
+
+    // The moved-from set is left empty.
+    ESetTree(ESetTree &&other) noexcept : root{other.root}, nil{other.nil}, cmp{other.cmp} {
+        pool.swap(other.pool);
+        other.root = other.nil = new Node;
+    }
+
+    ESetTree& operator=(ESetTree &&other) noexcept {
+        if (&other == this) return *this;
+        std::swap(root, other.root);
+        std::swap(nil, other.nil);
+        pool.swap(other.pool);
+        return *this;
+    }
+
+    ~ESetTree() {
+        clear();
+        delete nil;
+    }
+
+    // cmp as a three-way comparison, see ESetOrder.
+    int order(const Key &a, const Key &b) const {
+        return ESetOrder<Compare, Key>::compare(cmp, a, b);
+    }
+
+    // Other key types go through the transparent comparator, twice.
+    template <class A, class B>
+    int order(const A &a, const B &b) const {
+        if (cmp(a, b)) return -1;
+        return cmp(b, a);
+    }
+
+    /*
+    Destroy the keys of a whole subtree. The nodes themselves are left to
+    pool.clear(). Right rotations flatten the tree on the way, so there is no
+    recursion however deep the tree is.
+    */
+    void recollect(Node *ptr) {
+        if (std::is_trivially_destructible<Key>::value) return;
+        while (ptr != nil) {
+            if (ptr->s[0] != nil) {
+                Node *y = ptr->s[0];
+                ptr->s[0] = y->s[1];
+                y->s[1] = ptr;
+                ptr = y;
+            } else {
+                ptr->key.~Key();
+                ptr = ptr->s[1];
+            }
+        }
+    }
+
+    void freeNode(Node *x) {
+        x->key.~Key();
+        pool.deallocate(x);
+    }
+
+    /*
+    Copy the subtree of src_set rooted at src in preorder, walking both trees
+    in step along their parent pointers instead of recursing.
+    */
+    Node* clone(const Node *src, const ESetTree &src_set) {
+        if (src == src_set.nil) return nil;
+        const Node *snil = src_set.nil;
+        Derived &self = static_cast<Derived &>(*this);
+        pool.reserve(src->size);
+        Node *top = self.cloneNode(src), *dest = top;
+        top->fa = nil;
+        for (;;) {
+            if (src->s[0] != snil && dest->s[0] == nil) {
+                dest->link(0, self.cloneNode(src->s[0]));
+                src = src->s[0], dest = dest->s[0];
+            } else if (src->s[1] != snil && dest->s[1] == nil) {
+                dest->link(1, self.cloneNode(src->s[1]));
+                src = src->s[1], dest = dest->s[1];
+            } else if (dest == top) {
+                return top;
+            } else {
+                src = src->fa, dest = dest->fa;
+            }
+        }
+    }
+
+    int dir(const Node *ptr) const {
+        return ptr->fa->s[1] == ptr;
+    }
+
+    // The root's fa is not kept up to date by rotations, hence the root->fa = nil before climbing.
+    Node* findNext(const Node *x) const {
+        if (x == nil) return nil;
+        if (x->s[1] == nil) {
+            root->fa = nil;
+            for (; x->fa != nil && dir(x) == 1; x = x->fa);
+            return x->fa;
+        }
+        Node *y = x->s[1];
+        for (; y->s[0] != nil; y = y->s[0]);
+        return y;
+    }
+
+    // begin() is its own predecessor.
+    const Node* findPrev(const Node *x) const {
+        if (x == nil) return x;
+        if (x->s[0] == nil) {
+            const Node *y = x;
+            root->fa = nil;
+            for (; y->fa != nil && dir(y) == 0; y = y->fa);
+            return y->fa == nil ? x : y->fa;
+        }
+        x = x->s[0];
+        for (; x->s[1] != nil; x = x->s[1]);
+        return x;
+    }
+
+    const Node* findLast() const {
+        Node *x = root;
+        for (; x != nil && x->s[1] != nil; x = x->s[1]);
+        return x;
+    }
+
+    // The k-th smallest node, counting from 0, or nil if there are not that many.
+    const Node* findNth(size_t k) const {
+        const Node *x = root;
+        ESET_COUNT(descents);
+        for (; x != nil; ) {
+            ESET_COUNT(visits);
+            if (k < x->s[0]->size) {
+                x = x->s[0];
+            } else if (k > x->s[0]->size) {
+                k -= x->s[0]->size + 1;
+                x = x->s[1];
+            } else return x;
+        }
+        return nil;
+    }
+
+    // Number of nodes before x, climbing the parent pointers; size() for nil.
+    size_t position(const Node *x) const {
+        if (x == nil) return root->size;
+        size_t k = x->s[0]->size;
+        root->fa = nil;
+        for (; x->fa != nil; x = x->fa) {
+            if (dir(x) == 1) k += x->fa->s[0]->size + 1;
+        }
+        return k;
+    }
+
+    template <class K>
+    Node* nfind(const K &key) const {
+        Node *p = root;
+        ESET_COUNT(descents);
+        for (; p != nil; ) {
+            ESET_COUNT(visits);
+            int c = order(key, p->key);
+            if (c < 0) {
+                p = p->s[0];
+            } else if (c > 0) {
+                p = p->s[1];
+            } else return p;
+        }
+        return nil;
+    }
+
+public:
+    class iterator {
+        friend class ESetTree;
+        friend Derived;
+    private:
+        const ESetTree *from;
+        const Node *ptr;
+
+        iterator(const Node *ptr, const ESetTree *from) : from{from}, ptr{ptr} {}
+
+    public:
+        iterator() : from{nullptr}, ptr{nullptr} {}
+
+        const Key& operator*() const {
+            if (!ptr || ptr == from->nil) throw std::out_of_range("Out of range");
+            return ptr->key;
+        }
+
+        const Key* operator->() const {
+            if (!ptr || ptr == from->nil) throw std::out_of_range("Out of range");
+            return &ptr->key;
+        }
+
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        iterator operator--(int) {
+            iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        // Steps along the parent pointers, amortized O(1) over a full scan.
+        iterator& operator++() {
+            if (ptr) ptr = from->findNext(ptr);
+            return *this;
+        }
+
+        iterator& operator--() {
+            if (ptr) ptr = ptr == from->nil ? from->findLast() : from->findPrev(ptr);
+            return *this;
+        }
+
+        // Moves k positions in O(log n), stopping at begin() or end().
+        iterator& operator+=(std::ptrdiff_t k) {
+            if (!ptr) return *this;
+            size_t i = from->position(ptr);
+            if (k < 0) i = size_t(-k) < i ? i + k : 0;
+            else i += k;
+            ptr = from->findNth(i);
+            return *this;
+        }
+
+        iterator& operator-=(std::ptrdiff_t k) {
+            return *this += -k;
+        }
+
+        iterator operator+(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp += k;
+        }
+
+        iterator operator-(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp -= k;
+        }
+
+        bool operator==(const iterator &other) const {
+            return from == other.from && ptr == other.ptr;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return from != other.from || ptr != other.ptr;
+        }
+    };
+
+    iterator find(const Key &key) const {
+        return find<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator find(const K &key) const {
+        return iterator(nfind(key), this);
+    }
+
+    void clear() noexcept {
+        if (root != nil) recollect(root);
+        pool.clear();
+        root = nil;
+    }
+
+    size_t range(const Key &l, const Key &r) const {
+        return range<Key>(l, r);
+    }
+
+    // Descends together until the paths to l and r part, then follows each.
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t range(const K &l, const K &r) const {
+        if (cmp(r, l)) return 0;
+        Node *p = root;
+        ESET_COUNT(descents);
+        for (; p != nil; ) {
+            ESET_COUNT(visits);
+            if (cmp(p->key, l)) {
+                p = p->s[1];
+            } else if (cmp(r, p->key)) {
+                p = p->s[0];
+            } else break;
+        }
+        if (p == nil) return 0;
+        size_t cnt = 1;
+        for (Node *q = p->s[0]; q != nil; ) {
+            ESET_COUNT(visits);
+            if (!cmp(q->key, l)) {
+                cnt += q->s[1]->size + 1;
+                q = q->s[0];
+            } else q = q->s[1];
+        }
+        for (Node *q = p->s[1]; q != nil; ) {
+            ESET_COUNT(visits);
+            if (!cmp(r, q->key)) {
+                cnt += q->s[0]->size + 1;
+                q = q->s[1];
+            } else q = q->s[0];
+        }
+        return cnt;
+    }
+
+    // The k-th smallest key, counting from 0, or end() if k >= size().
+    iterator nth(size_t k) const {
+        return iterator(findNth(k), this);
+    }
+
+    // Number of keys less than key.
+    size_t rank(const Key &key) const {
+        return rank<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t rank(const K &key) const {
+        size_t cnt = 0;
+        ESET_COUNT(descents);
+        for (Node *p = root; p != nil; ) {
+            ESET_COUNT(visits);
+            if (cmp(p->key, key)) {
+                cnt += p->s[0]->size + 1;
+                p = p->s[1];
+            } else p = p->s[0];
+        }
+        return cnt;
+    }
+
+    size_t size() const noexcept {
+        return root->size;
+    }
+
+    iterator lower_bound(const Key &key) const {
+        return lower_bound<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator lower_bound(const K &key) const {
+        Node *p = root, *ret = nil;
+        ESET_COUNT(descents);
+        for (; p != nil; ) {
+            ESET_COUNT(visits);
+            if (!cmp(p->key, key)) {
+                ret = p;
+                p = p->s[0];
+            } else p = p->s[1];
+        }
+        return iterator(ret, this);
+    }
+
+    iterator upper_bound(const Key &key) const {
+        return upper_bound<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator upper_bound(const K &key) const {
+        Node *p = root, *ret = nil;
+        ESET_COUNT(descents);
+        for (; p != nil; ) {
+            ESET_COUNT(visits);
+            if (cmp(key, p->key)) {
+                ret = p;
+                p = p->s[0];
+            } else p = p->s[1];
+        }
+        return iterator(ret, this);
+    }
+
+    iterator begin() const noexcept {
+        Node *p = root;
+        for (; p != nil && p->s[0] != nil; p = p->s[0]);
+        return iterator(p, this);
+    }
+
+    iterator end() const noexcept {
+        return iterator(nil, this);
+    }
+};
+
+#endif // ESET_BST_HPP
@@ -0,0 +1,117 @@
+#ifndef ESET_COMMON_HPP
+#define ESET_COMMON_HPP
+
+/*
+What every backend shares: the -DESET_STATS counters, three-way comparison
+through the comparator, and the rules for heterogeneous lookup.
+*/
+
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#if __cplusplus > 201703L
+#include <compare>
+#endif
+
+#ifdef ESET_STATS
+/*
+Counters of the structural work done by ESet, compiled in with -DESET_STATS.
+They are global, so reset() them before the code you want to measure.
+*/
+struct ESetStats {
+    size_t rotations = 0;   // single rotations
+    size_t recolors = 0;    // red-black fix-up cases that only recolor
+    size_t splays = 0;      // splay steps (zig, zig-zig or zig-zag)
+    size_t copies = 0;      // nodes copied to keep old versions intact
+    size_t compares = 0;    // comparator calls
+    size_t descents = 0;    // searches starting from the root
+    size_t visits = 0;      // nodes visited by those searches
+
+    static ESetStats& get() {
+        static ESetStats stats;
+        return stats;
+    }
+
+    static void reset() {
+        get() = ESetStats();
+    }
+};
+
+template <class Compare>
+struct ESetCountedCompare {
+    Compare cmp;
+
+    template <class A, class B>
+    bool operator()(const A &a, const B &b) const {
+        ++ESetStats::get().compares;
+        return cmp(a, b);
+    }
+
+    template <class A, class B, class C = Compare>
+    auto compare(const A &a, const B &b) const -> decltype(std::declval<const C &>().compare(a, b)) {
+        ++ESetStats::get().compares;
+        return cmp.compare(a, b);
+    }
+};
+
+#define ESET_COUNT(field) (++ESetStats::get().field)
+#define ESET_COMPARE(Compare) ESetCountedCompare<Compare>
+#else
+#define ESET_COUNT(field) ((void)0)
+#define ESET_COMPARE(Compare) Compare
+#endif
+
+/*
+One three-way comparison of a with b: negative, zero or positive. A
+comparator opts in with a member int compare(a, b) const. std::less on a key
+with a total operator<=> uses that under C++20. Any other comparator is
+called twice, cmp(a, b) and then cmp(b, a).
+*/
+template <class Compare, class Key, class = void>
+struct ESetOrder {
+    template <class C>
+    static int compare(const C &cmp, const Key &a, const Key &b) {
+        if (cmp(a, b)) return -1;
+        return cmp(b, a);
+    }
+};
+
+template <class Compare, class Key>
+struct ESetOrder<Compare, Key, decltype(void(std::declval<const Compare &>().compare(std::declval<const Key &>(), std::declval<const Key &>())))> {
+    template <class C>
+    static int compare(const C &cmp, const Key &a, const Key &b) {
+        return cmp.compare(a, b);
+    }
+};
+
+#ifdef __cpp_lib_three_way_comparison
+template <class Key>
+struct ESetOrder<std::less<Key>, Key, std::enable_if_t<std::three_way_comparable<Key, std::weak_ordering>>> {
+    template <class C>
+    static int compare(const C &, const Key &a, const Key &b) {
+        ESET_COUNT(compares);
+        auto c = a <=> b;
+        return c < 0 ? -1 : c > 0;
+    }
+};
+#endif
+
+/*
+Heterogeneous lookups take any K when Compare is transparent, like those of
+std::set; otherwise only Key. emplace searches for its argument before making
+a Key of it when that argument is such a K, so a duplicate costs nothing.
+*/
+template <class Compare, class Key, class K, class = void>
+struct ESetLookup : std::is_same<K, Key> {};
+
+template <class Compare, class Key, class K>
+struct ESetLookup<Compare, Key, K, std::void_t<typename Compare::is_transparent>> : std::true_type {};
+
+template <class Compare, class Key, class... Args>
+struct ESetEmplaceLookup : std::false_type {};
+
+template <class Compare, class Key, class Arg>
+struct ESetEmplaceLookup<Compare, Key, Arg> : ESetLookup<Compare, Key, std::decay_t<Arg>> {};
+
+#endif // ESET_COMMON_HPP
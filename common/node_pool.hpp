@@ -0,0 +1,102 @@
+#ifndef ESET_NODE_POOL_HPP
+#define ESET_NODE_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+Slab allocator owned by one set, for the backends whose nodes have a parent
+pointer fa. Nodes are carved out of chunks that grow geometrically, and
+erased nodes go to a free list, linked through fa, for the next emplace.
+All chunks are released together when the set is cleared. A copy reserves
+a single chunk for the whole tree.
+*/
+template <class Node>
+class ESetNodePool {
+private:
+    static constexpr size_t MIN_CHUNK = 32, MAX_CHUNK = 1 << 16;
+
+    std::vector<std::pair<Node*, size_t>> chunks;
+    Node *freed, *cur;
+    size_t left, total;
+
+    void grow(size_t n) {
+        Node *chunk = std::allocator<Node>().allocate(n);
+        chunks.emplace_back(chunk, n);
+        cur = chunk;
+        left = n;
+        total += n;
+    }
+
+public:
+    ESetNodePool() : freed{nullptr}, cur{nullptr}, left{0}, total{0} {}
+
+    ESetNodePool(const ESetNodePool &) = delete;
+    ESetNodePool& operator=(const ESetNodePool &) = delete;
+
+    ~ESetNodePool() {
+        clear();
+    }
+
+    Node* allocate() {
+        Node *x;
+        if (freed) {
+            x = freed;
+            freed = freed->fa;
+        } else {
+            if (!left) grow(total < MIN_CHUNK ? MIN_CHUNK : total < MAX_CHUNK ? total : MAX_CHUNK);
+            x = cur++;
+            left--;
+        }
+        return new (x) Node;
+    }
+
+    // Make sure the next n allocations come from one chunk.
+    void reserve(size_t n) {
+        if (left < n) grow(n);
+    }
+
+    // The key must already be destroyed.
+    void deallocate(Node *x) {
+        x->fa = freed;
+        freed = x;
+    }
+
+    // Drop every node but keep one chunk that can hold n of them.
+    void reset(size_t n) {
+        size_t keep = chunks.size();
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (chunks[i].second >= n && (keep == chunks.size() || chunks[i].second < chunks[keep].second)) keep = i;
+        }
+        if (keep == chunks.size()) {
+            clear();
+            return;
+        }
+        std::swap(chunks[0], chunks[keep]);
+        for (size_t i = 1; i < chunks.size(); i++) std::allocator<Node>().deallocate(chunks[i].first, chunks[i].second);
+        chunks.resize(1);
+        freed = nullptr;
+        cur = chunks[0].first;
+        left = total = chunks[0].second;
+    }
+
+    void clear() {
+        for (auto &c : chunks) std::allocator<Node>().deallocate(c.first, c.second);
+        chunks.clear();
+        freed = cur = nullptr;
+        left = total = 0;
+    }
+
+    void swap(ESetNodePool &other) {
+        chunks.swap(other.chunks);
+        std::swap(freed, other.freed);
+        std::swap(cur, other.cur);
+        std::swap(left, other.left);
+        std::swap(total, other.total);
+    }
+};
+
+#endif // ESET_NODE_POOL_HPP
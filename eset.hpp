@@ -0,0 +1,102 @@
+#ifndef ESET_HPP
+#define ESET_HPP
+
+/*
+All the backends in one header, chosen per set by a policy:
+
+    ESet<int>                                     red-black tree
+    ESet<int, std::less<int>, eset::Splay>        splay tree
+    ESet<int, std::less<int>, eset::Treap>        persistent treap
+    ESet<int, std::less<int>, eset::AVL>          AVL tree
+    ESet<int, std::less<int>, eset::BPlus>        B+ tree
+    ESet<int, std::less<int>, eset::SkipList>     skip list
+    ESet<int, std::less<int>, eset::IntegerTrie>  64-way trie, for integer keys
+    ESet<int, std::less<int>, eset::ART>          adaptive radix tree, for integer and string keys
+
+so sets of different backends can live in the same program. A backend is a
+struct whose member template set<Key, Compare> names the class implementing
+it; a new engine needs its own header and one such struct.
+
+The header in each backend directory still works on its own, and then
+defines ESet in the global namespace for that backend only. Only the first
+header to be included defines the global ESet: include this one after a
+backend's and ::ESet stays that backend's, with the policies still
+available as eset::ESet.
+*/
+
+#ifndef ESET_NO_GLOBAL
+#define ESET_NO_GLOBAL
+#endif
+#include "rbtree/eset.hpp"
+#include "avl/eset.hpp"
+#include "splay/eset.hpp"
+#include "treap/eset.hpp"
+#include "bplus/eset.hpp"
+#include "skiplist/eset.hpp"
+#include "trie/eset.hpp"
+#include "art/eset.hpp"
+
+namespace eset {
+
+struct RedBlack {
+    template <class Key, class Compare>
+    using set = rbtree::ESet<Key, Compare>;
+};
+
+// The red-black tree with O(1) copies that share structure.
+struct PersistentRedBlack {
+    template <class Key, class Compare>
+    using set = rbtree::ESet<Key, Compare, true>;
+};
+
+struct AVL {
+    template <class Key, class Compare>
+    using set = avl::ESet<Key, Compare>;
+};
+
+struct Splay {
+    template <class Key, class Compare>
+    using set = splay::ESet<Key, Compare>;
+};
+
+struct Treap {
+    template <class Key, class Compare>
+    using set = treap::ESet<Key, Compare>;
+};
+
+// Wide nodes and linked leaves: fewer cache misses per search, O(1) iteration.
+struct BPlus {
+    template <class Key, class Compare>
+    using set = bplus::ESet<Key, Compare>;
+};
+
+struct SkipList {
+    template <class Key, class Compare>
+    using set = skiplist::ESet<Key, Compare>;
+};
+
+// The trie where it applies (integer keys under std::less), the red-black tree elsewhere.
+// With the trie *it is a const Key by value, not a reference into the set, and there is no operator->.
+struct IntegerTrie {
+    template <class Key, class Compare>
+    using set = std::conditional_t<trie::Applies<Key, Compare>::value, trie::ESet<Key, Compare>, rbtree::ESet<Key, Compare>>;
+};
+
+// Same fallback: the radix tree takes integers and std::string under std::less.
+struct ART {
+    template <class Key, class Compare>
+    using set = std::conditional_t<art::Applies<Key, Compare>::value, art::ESet<Key, Compare>, rbtree::ESet<Key, Compare>>;
+};
+
+template <class Key, class Compare = std::less<Key>, class Backend = RedBlack>
+using ESet = typename Backend::template set<Key, Compare>;
+
+} // namespace eset
+
+#ifndef ESET_GLOBAL_DEFINED
+#define ESET_GLOBAL_DEFINED
+template <class Key, class Compare = std::less<Key>, class Backend = eset::RedBlack>
+using ESet = eset::ESet<Key, Compare, Backend>;
+#endif
+
+#endif
@@ -1,71 +1,92 @@
-#ifndef ESET_H
+#ifndef ESET_RBTREE_HPP
 
-#define ESET_H
+#define ESET_RBTREE_HPP
 
 // #include <functional>
 // #include <exception>
+#include <cstddef>
+#include <functional>
 #include <stdexcept>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if __cplusplus > 201703L
+#include <compare>
+#endif
 #ifdef DEBUG
 #include <iostream>
 #endif
 
-template <class Key, class Compare = std::less<Key> >
-class ESet {
-private:
-    struct Node {
-        Node *s[2], *fa;
-        Key *key;
-        size_t size;
-        bool black;
-
-        //Initially black
-        Node() : s{nullptr, nullptr}, fa{nullptr}, key{nullptr}, size{0}, black{true} {}
+#include "../common/bst.hpp"
 
-        ~Node() {
-            if (key) delete key;
-            key = nullptr;
-        }
+namespace eset::rbtree {
 
-        void link(int pos, Node *son) {
-            son->fa = this;
-            this->s[pos] = son;
-        }
+template <class Key>
+struct RbNode {
+    RbNode *s[2], *fa;
+    size_t size;
+    bool black;
+    // Stored in the node itself; constructed by newLeaf/clone only, so nil has none.
+    union {
+        Key key;
     };
 
-    Node *root, *nil;
-    Compare cmp;
+    //Initially black
+    RbNode() : s{nullptr, nullptr}, fa{nullptr}, size{0}, black{true} {}
 
-    void recollect(Node *ptr) {
-        if (ptr == nil) return;
-        recollect(ptr->s[0]), recollect(ptr->s[1]);
-        delete ptr;
+    ~RbNode() {}
+
+    void link(int pos, RbNode *son) {
+        son->fa = this;
+        this->s[pos] = son;
     }
+};
+
+/*
+Red-black tree with parent pointers. With Persistent = true, the
+specialization further down is used instead: O(1) copies that share structure.
+*/
+template <class Key, class Compare = std::less<Key>, bool Persistent = false>
+class ESet : public ESetTree<ESet<Key, Compare, Persistent>, RbNode<Key>, Key, Compare> {
+    friend ESetTree<ESet, RbNode<Key>, Key, Compare>;
 
-    Node* clone(const Node *src, const ESet &src_set) {
-        if (src == src_set.nil) return nil;
-        Node *dest = new Node;
+private:
+    typedef RbNode<Key> Node;
+    typedef ESetTree<ESet, Node, Key, Compare> BST;
+
+    using BST::root;
+    using BST::nil;
+    using BST::pool;
+    using BST::order;
+    using BST::recollect;
+    using BST::freeNode;
+    using BST::clone;
+    using BST::dir;
+    using BST::findNext;
+    using BST::nfind;
+
+    Node* cloneNode(const Node *src) {
+        Node *dest = pool.allocate();
         dest->black = src->black;
         dest->size = src->size;
-        dest->key = new Key(*src->key);
-        dest->link(0, clone(src->s[0], src_set));
-        dest->link(1, clone(src->s[1], src_set));
+        dest->s[0] = dest->s[1] = nil;
+        new (&dest->key) Key(src->key);
         return dest;
     }
 
-    Node* newLeaf(Key &&key) {
-        Node *leaf = new Node;
+    template <class K>
+    Node* newLeaf(K &&key) {
+        Node *leaf = pool.allocate();
         leaf->link(0, nil);
         leaf->link(1, nil);
         leaf->black = false;
         leaf->size = 1;
-        leaf->key = new Key(std::move(key));
+        new (&leaf->key) Key(std::forward<K>(key));
         return leaf;
     }
 
-    int dir(const Node *ptr) const {
-        return ptr->fa->s[1] == ptr;
-    }
-
     Node* bro(const Node *ptr) const {
         return ptr->fa->s[dir(ptr)^1];
     }
@@ -76,6 +97,7 @@ private:
 
     void rotate(Node *x) {
         if (x==root) return;
+        ESET_COUNT(rotations);
         Node *y = x->fa, *z = y->fa;
         int t=dir(x);
         if (y!=root) z->link(dir(y), x);
@@ -92,69 +114,17 @@ private:
         #endif
     }
 
-    Node* findNext(Node *x) {
-        if (x==nil) return x;
-        if (x->s[1]==nil) {
-            root->fa = nil;
-            for (; x->fa!=nil && dir(x)==1; x=x->fa);
-            return x->fa;
-        }
-        x = x->s[1];
-        for (; x->s[0]!=nil; x=x->s[0]);
-        return x;
-    }
-
-    const Node* findNext(const Node *x) const {
-        if (x==nil) return x;
-        if (x->s[1]==nil) {
-            root->fa = nil;
-            for (; x->fa!=nil && dir(x)==1; x=x->fa);
-            return x->fa;
-        }
-        x = x->s[1];
-        for (; x->s[0]!=nil; x=x->s[0]);
-        return x;
-    }
-
-    Node* findPrev(Node *x) {
-        if (x==nil) return x;
-        if (x->s[0]==nil) {
-            Node *y = x;
-            root->fa = nil;
-            for (; y->fa!=nil && dir(y)==0; y=y->fa);
-            return y->fa==nil ? x : y->fa;
-        }
-        x = x->s[0];
-        for (; x->s[1]!=nil; x=x->s[1]);
-        return x;
-    }
-
-    const Node* findPrev(const Node *x) const {
-        if (x==nil) return x;
-        if (x->s[0]==nil) {
-            const Node *y = x;
-            root->fa = nil;
-            for (; y->fa!=nil && dir(y)==0; y=y->fa);
-            return y->fa==nil ? x : y->fa;
-        }
-        x = x->s[0];
-        for (; x->s[1]!=nil; x=x->s[1]);
-        return x;
-    }
-    std::pair<Node*, int> findEmplacePos(Node *x, const Key &key) const {
-        if (cmp(key, *x->key)) {
+    template <class K>
+    std::pair<Node*, int> findEmplacePos(Node *x, const K &key) const {
+        ESET_COUNT(visits);
+        int c = order(key, x->key);
+        if (c < 0) {
             return x->s[0]==nil ? std::make_pair(x, 0) : findEmplacePos(x->s[0], key);
-        } else if (cmp(*x->key, key)) {
+        } else if (c > 0) {
             return x->s[1]==nil ? std::make_pair(x, 1) : findEmplacePos(x->s[1], key);
         } else return std::make_pair(x, -1);
     }
 
-    const Node* findLast() const {
-        Node *x = root;
-        for (; x!=nil && x->s[1]!=nil; x=x->s[1]);
-        return x;
-    }
-
     void maintainEmplace(Node *x) {
         for (;;) {
             // Case 2: x->fa is root or black
@@ -162,6 +132,7 @@ private:
             // Case 3: x->fa->bro is red
             Node *unc = bro(x->fa);
             if (!unc->black) {
+                ESET_COUNT(recolors);
                 x->fa->black = unc->black = true;
                 x = x->fa->fa;
                 x->black = false;
@@ -194,12 +165,14 @@ private:
             }
             // Case 2: bro and its children are both black and the parent is red
             if (b->black && b->s[0]->black && b->s[1]->black && !x->fa->black) {
+                ESET_COUNT(recolors);
                 x->fa->black = true;
                 b->black = false;
                 return;
             }
             // Case 3: bro and its children and the parent are all black
             if (b->black && b->s[0]->black && b->s[1]->black && x->fa->black) {
+                ESET_COUNT(recolors);
                 b->black = false;
                 x = x->fa;
                 continue;
@@ -223,106 +196,219 @@ private:
         }
     }
 
+    /*
+    Swap the positions of x and its successor y in the tree, colors and sizes
+    staying with the positions. Moving the nodes instead of their keys keeps
+    iterators to y valid while x is being erased.
+    */
+    void exchange(Node *x, Node *y) {
+        Node *xf = x->fa, *xl = x->s[0], *xr = x->s[1], *yf = y->fa, *yr = y->s[1];
+        bool xroot = x == root;
+        int xd = xroot ? 0 : dir(x);
+        std::swap(x->black, y->black);
+        std::swap(x->size, y->size);
+        if (yf == x) {
+            y->link(1, x);
+        } else {
+            yf->link(0, x);
+            y->link(1, xr);
+        }
+        x->link(0, nil);
+        x->link(1, yr);
+        y->link(0, xl);
+        if (xroot) {
+            root = y;
+            y->fa = nil;
+        } else xf->link(xd, y);
+    }
+
     void updateToRoot(Node *x) {
         for (; x!=root; x = x->fa) update(x);
         update(root);
     }
 
-    #ifdef DEBUG
-    void debug_print(Node *ptr, int x) const {
-        if (ptr==nil) return;
-        std::cerr << x << ": " << (ptr->black? "black" : "red") << ", size: " << ptr->size << ", key: " << *ptr->key << "\n";
-        debug_print(ptr->s[0], x*2);
-        debug_print(ptr->s[1], x*2+1);
+    /*
+    Join-based set algebra. The functions below take apart the tree of this
+    set and put it together again with join, so root is only scratch space
+    while they run: join makes the taller tree the root for a moment to reuse
+    rotate and maintainEmplace. A Tree is a subtree cut loose from its
+    parent, together with its black height (black nodes on a path down from
+    t, nil not counted). Its root may be red.
+    */
+    struct Tree {
+        Node *t;
+        int h;
+    };
+
+    Tree child(Tree x, int d) const {
+        return Tree{x.t->s[d], x.h - x.t->black};
     }
-    #endif
 
-    Node* nfind(const Key &key) {
-        Node *p = root;
-        for (; p!=nil; ) {
-            if (cmp(key, *p->key)) {
-                p = p->s[0];
-            } else if (cmp(*p->key, key)) {
-                p = p->s[1];
-            } else return p;
+    // Destroy a whole subtree, flattening it on the way like recollect.
+    void freeTree(Node *ptr) {
+        while (ptr != nil) {
+            if (ptr->s[0] != nil) {
+                Node *y = ptr->s[0];
+                ptr->s[0] = y->s[1];
+                y->s[1] = ptr;
+                ptr = y;
+            } else {
+                Node *next = ptr->s[1];
+                freeNode(ptr);
+                ptr = next;
+            }
         }
-        return nil;
     }
 
-    const Node* nfind(const Key &key) const {
-        Node *p = root;
-        for (; p!=nil; ) {
-            if (cmp(key, *p->key)) {
-                p = p->s[0];
-            } else if (cmp(*p->key, key)) {
-                p = p->s[1];
-            } else return p;
+    // The tree made of l, the node k and r, every key of l below k and of r above.
+    Tree join(Tree l, Node *k, Tree r) {
+        if (!l.t->black) l.t->black = true, l.h++;
+        if (!r.t->black) r.t->black = true, r.h++;
+        k->black = false;
+        if (l.h == r.h) {
+            k->link(0, l.t);
+            k->link(1, r.t);
+            update(k);
+            return Tree{k, l.h};
         }
-        return nil;
+        // Hang k with the shorter tree in place of the first black node of
+        // the same black height down the facing spine of the taller one.
+        int t = l.h > r.h;
+        Tree a = t ? l : r, b = t ? r : l;
+        Node *c = a.t, *f = nil;
+        for (int h = a.h; !(c->black && h == b.h); f = c, c = c->s[t]) h -= c->black;
+        f->link(t, k);
+        k->link(t^1, c);
+        k->link(t, b.t);
+        update(k);
+        root = a.t;
+        root->fa = nil;
+        updateToRoot(f);
+        maintainEmplace(k);
+        root->fa = nil;
+        return Tree{root, a.h};
     }
 
-public:
-
-    class iterator {
-        friend class ESet<Key, Compare>;
-    private:
-        const ESet *from;
-        const Key *key;
+    // Cut off the smallest node of x, which must not be empty.
+    std::pair<Node*, Tree> splitFirst(Tree x) {
+        Node *k = x.t;
+        if (k->s[0] == nil) return std::make_pair(k, child(x, 1));
+        auto p = splitFirst(child(x, 0));
+        return std::make_pair(p.first, join(p.second, k, child(x, 1)));
+    }
 
-        iterator(const Node *ptr, const ESet *from) : key{ptr->key}, from{from} {}
-        iterator(const Key *key, const ESet *from) : key{key}, from{from} {}
+    Tree join(Tree l, Tree r) {
+        if (l.t == nil) return r;
+        if (r.t == nil) return l;
+        auto p = splitFirst(r);
+        return join(l, p.first, p.second);
+    }
 
-        const Node* find() {
-            return key ? from->nfind(*key) : from->nil;
+    // Split x into the keys below and above key, and return the node of key or nil.
+    Node* split(Tree x, const Key &key, Tree &l, Tree &r) {
+        if (x.t == nil) {
+            l = r = Tree{nil, 0};
+            return nil;
+        }
+        ESET_COUNT(visits);
+        Node *k = x.t, *m;
+        int c = order(key, k->key);
+        if (c < 0) {
+            m = split(child(x, 0), key, l, r);
+            r = join(r, k, child(x, 1));
+        } else if (c > 0) {
+            m = split(child(x, 1), key, l, r);
+            l = join(child(x, 0), k, l);
+        } else {
+            l = child(x, 0);
+            r = child(x, 1);
+            m = k;
         }
+        return m;
+    }
 
-    public:
-        iterator() : key{nullptr}, from{nullptr} {}
+    /*
+    Combine x, a tree of this set, with the subtree y of other, whose black
+    height is yh. other is only read: its keys split x, and the keys that
+    are missing here are copied in. The nodes of x that stay are kept, so
+    iterators to them stay valid. These take O(m log(n/m + 1)) for sizes
+    m <= n.
+    */
+    Tree unite(Tree x, const Node *y, int yh, const ESet &other) {
+        if (y == other.nil) return x;
+        if (x.t == nil) return Tree{clone(y, other), yh};
+        Tree l, r;
+        Node *m = split(x, y->key, l, r);
+        int ch = yh - y->black;
+        l = unite(l, y->s[0], ch, other);
+        r = unite(r, y->s[1], ch, other);
+        return join(l, m != nil ? m : cloneNode(y), r);
+    }
 
-        const Key& operator*() const { 
-            if (!key) throw std::out_of_range("Out of range");
-            return *key; 
+    Tree intersect(Tree x, const Node *y, int yh, const ESet &other) {
+        if (x.t == nil) return x;
+        if (y == other.nil) {
+            freeTree(x.t);
+            return Tree{nil, 0};
         }
+        Tree l, r;
+        Node *m = split(x, y->key, l, r);
+        int ch = yh - y->black;
+        l = intersect(l, y->s[0], ch, other);
+        r = intersect(r, y->s[1], ch, other);
+        return m != nil ? join(l, m, r) : join(l, r);
+    }
 
-        const Key* operator->() const { 
-            if (!key) throw std::out_of_range("Out of range");
-            return key; 
-        }
-        
-        iterator operator++(int) {
-            iterator tmp = *this;
-            const Node *ptr = find();
-            key = from->findNext(ptr)->key;
-            return tmp;
-        }
+    Tree subtract(Tree x, const Node *y, int yh, const ESet &other) {
+        if (x.t == nil || y == other.nil) return x;
+        Tree l, r;
+        Node *m = split(x, y->key, l, r);
+        if (m != nil) freeNode(m);
+        int ch = yh - y->black;
+        l = subtract(l, y->s[0], ch, other);
+        r = subtract(r, y->s[1], ch, other);
+        return join(l, r);
+    }
 
-        iterator operator--(int) {
-            iterator tmp = *this;
-            const Node *ptr = find();
-            key = ptr == from->nil ? from->findLast()->key : from->findPrev(ptr)->key;
-            return tmp;
-        }
+    Tree symmetricSubtract(Tree x, const Node *y, int yh, const ESet &other) {
+        if (y == other.nil) return x;
+        if (x.t == nil) return Tree{clone(y, other), yh};
+        Tree l, r;
+        Node *m = split(x, y->key, l, r);
+        int ch = yh - y->black;
+        l = symmetricSubtract(l, y->s[0], ch, other);
+        r = symmetricSubtract(r, y->s[1], ch, other);
+        if (m == nil) return join(l, cloneNode(y), r);
+        freeNode(m);
+        return join(l, r);
+    }
 
-        iterator& operator++() {
-            const Node *ptr = find();
-            key = from->findNext(ptr)->key;
-            return *this;
-        }
+    int blackHeight(const Node *x) const {
+        int h = 0;
+        for (; x != nil; x = x->s[0]) h += x->black;
+        return h;
+    }
 
-        iterator& operator--() {
-            const Node *ptr = find();
-            key = ptr == from->nil ? from->findLast()->key : from->findPrev(ptr)->key;
-            return *this;
-        }
+    template <class Op>
+    void combine(const ESet &other, Op op) {
+        Tree x = (this->*op)(Tree{root, blackHeight(root)}, other.root, other.blackHeight(other.root), other);
+        root = x.t;
+        root->fa = nil;
+        root->black = true;
+    }
 
-        bool operator==(const iterator &other) const {
-            return from == other.from && key == other.key;
-        }
+    #ifdef DEBUG
+    void debug_print(Node *ptr, int x) const {
+        if (ptr==nil) return;
+        std::cerr << x << ": " << (ptr->black? "black" : "red") << ", size: " << ptr->size << ", key: " << ptr->key << "\n";
+        debug_print(ptr->s[0], x*2);
+        debug_print(ptr->s[1], x*2+1);
+    }
+    #endif
 
-        bool operator!=(const iterator &other) const {
-            return from != other.from || key != other.key;
-        }
-    };
+public:
+    using typename BST::iterator;
+    using BST::clear;
 
     // class const_iterator : iterator {
     //     friend class ESet<Key, Compare>;
@@ -346,57 +432,41 @@ public:
     //     }
     // };
 
-    ESet() : root{nullptr}, nil{new Node} {
-        nil->black = true;
-        root = nil;
-    }
-
-    ~ESet() {
-        clear();
-        if (nil != nullptr) delete nil;
-    }
+    ESet() = default;
 
-    ESet(const ESet &other) : root{nullptr}, nil(new Node) {
+    ESet(const ESet &other) : BST(other) {
         root = clone(other.root, other);
     }
 
     ESet& operator=(const ESet &other) {
         if (&other == this) return *this;
-        clear();
+        // Like clear(), but the memory of the old tree is reused for the copy.
+        if (root != nil) recollect(root);
+        pool.reset(other.size());
         root = clone(other.root, other);
         return *this;
     }
 
-    ESet(ESet &&other) noexcept : root{std::move(other.root)}, nil{std::move(other.nil)} {
-        other.root = other.nil = new Node;
-    }
-    
-    ESet& operator=(ESet &&other) noexcept {
-        if (&other == this) return *this;
-        clear();
-        if (nil) delete nil;
-        root = std::move(other.root);
-        nil = std::move(other.nil);
-        other.root = other.nil = nullptr;
-        return *this;
-    }
-    
-    template <class... Args>
-    std::pair<iterator, bool> emplace(Args &&... args) {
-        Key tar(std::forward<Args>(args)...);
+    ESet(ESet &&other) noexcept = default;
+    ESet& operator=(ESet &&other) noexcept = default;
+
+private:
+    template <class K>
+    std::pair<iterator, bool> emplaceKey(std::true_type, K &&tar) {
         //Case 1: empty
         if (root==nil) {
-            root = newLeaf(std::move(tar));
+            root = newLeaf(std::forward<K>(tar));
             return std::make_pair(iterator(root, this), true);
         }
 
         Node *p, *np;
         int flag;
+        ESET_COUNT(descents);
         auto temp = findEmplacePos(root, tar);
         p = temp.first;
         flag = temp.second;
         if (flag<0) return std::make_pair(iterator(p, this), false);
-        p->link(flag, np = newLeaf(std::move(tar)));
+        p->link(flag, np = newLeaf(std::forward<K>(tar)));
 
         updateToRoot(np);
         maintainEmplace(np);
@@ -409,17 +479,30 @@ public:
         return std::make_pair(iterator(np, this), true);
     }
 
+    template <class... Args>
+    std::pair<iterator, bool> emplaceKey(std::false_type, Args &&... args) {
+        return emplaceKey(std::true_type(), Key(std::forward<Args>(args)...));
+    }
+
+public:
+    // The Key is only made once it is known to be new, if the argument can be looked up as is.
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        return emplaceKey(ESetEmplaceLookup<Compare, Key, Args...>(), std::forward<Args>(args)...);
+    }
+
     size_t erase(const Key &key) {
+        return erase<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t erase(const K &key) {
         Node *x = nfind(key), *y;
         // Not exist
         if (x == nil) return 0;
         root->black = true;
         // In case that x has two children
-        if (x->s[0] != nil && x->s[1] != nil) {
-            y = findNext(x);
-            std::swap(x->key, y->key);
-            x = y;
-        }
+        if (x->s[0] != nil && x->s[1] != nil) exchange(x, findNext(x));
 
         // Case A: x has only one child
         // At this time, x->s must be red and x must be black
@@ -433,7 +516,7 @@ public:
                 x->fa->link(dir(x), y);
                 updateToRoot(x->fa);
             }
-            delete x;
+            freeNode(x);
             return 1;
         }
 
@@ -441,14 +524,14 @@ public:
         // Case B.0: x is root
         if (x == root) {
             root = nil;
-            delete x;
+            freeNode(x);
             return 1;
         }
         // Case B.1: x is red
         if (!x->black) {
             x->fa->link(dir(x), nil);
             updateToRoot(x->fa);
-            delete x;
+            freeNode(x);
             return 1;
         }
         // Case B.2: x is black
@@ -456,7 +539,7 @@ public:
             maintainErase(x);
             x->fa->link(dir(x), nil);
             updateToRoot(x->fa);
-            delete x;
+            freeNode(x);
             return 1;
         }
 
@@ -464,88 +547,587 @@ public:
         return -1;
     }
 
-    iterator find(const Key &key) const {
-        Node *p = root;
-        for (; p!=nil; ) {
-            if (cmp(key, *p->key)) {
+    /*
+    Set algebra with another set, in O(m log(n/m + 1)) for sizes m <= n.
+    Iterators to keys that stay in this set stay valid.
+    */
+    void union_with(const ESet &other) {
+        if (&other != this) combine(other, &ESet::unite);
+    }
+
+    void intersect_with(const ESet &other) {
+        if (&other != this) combine(other, &ESet::intersect);
+    }
+
+    void difference_with(const ESet &other) {
+        if (&other == this) clear();
+        else combine(other, &ESet::subtract);
+    }
+
+    void symmetric_difference(const ESet &other) {
+        if (&other == this) clear();
+        else combine(other, &ESet::symmetricSubtract);
+    }
+
+    // const_iterator cbegin() const noexcept {
+    //     return const_iterator(begin());
+    // }
+
+    // const_iterator cend() const noexcept {
+    //     return const_iterator(end());
+    // }
+};
+
+/*
+Persistent mode: ESet<Key, Compare, true>.
+
+Copying shares the whole tree and costs O(1). The tree is a left-leaning
+red-black tree without parent pointers, and nodes are reference counted:
+emplace and erase copy the nodes on their search path that are shared with
+another set and modify the rest in place. Keys live in reference-counted
+items that all copies of a node point to, so an iterator, which holds the
+item, stays valid until its key is erased from its own set. Iterators step by
+searching from the root, O(log n) each.
+*/
+template <class Key, class Compare>
+class ESet<Key, Compare, true> {
+private:
+    struct Item {
+        Key key;
+        size_t ref;
+
+        template <class... Args>
+        Item(Args&&... args) : key(std::forward<Args>(args)...), ref{0} {}
+    };
+
+    struct Node {
+        Node *s[2];
+        Item *item;
+        size_t size, ref;
+        bool red;
+
+        Node(Item *item) : s{nullptr, nullptr}, item{item}, size{1}, ref{1}, red{true} {
+            item->ref++;
+        }
+    };
+
+    Node *root;
+    ESET_COMPARE(Compare) cmp;
+
+    // cmp as a three-way comparison, see ESetOrder.
+    int order(const Key &a, const Key &b) const {
+        return ESetOrder<Compare, Key>::compare(cmp, a, b);
+    }
+
+    // Other key types go through the transparent comparator, twice.
+    template <class A, class B>
+    int order(const A &a, const B &b) const {
+        if (cmp(a, b)) return -1;
+        return cmp(b, a);
+    }
+
+    static bool isRed(const Node *x) {
+        return x && x->red;
+    }
+
+    static size_t getSize(const Node *x) {
+        return x ? x->size : 0;
+    }
+
+    static void update(Node *x) {
+        x->size = getSize(x->s[0]) + getSize(x->s[1]) + 1;
+    }
+
+    static void dropItem(Item *item) {
+        if (!--item->ref) delete item;
+    }
+
+    // Free a node that is not referenced any more, but not its children.
+    static void freeNode(Node *x) {
+        dropItem(x->item);
+        delete x;
+    }
+
+    // Drop one reference to x, freeing whatever becomes unreachable.
+    static void release(Node *x) {
+        if (!x || --x->ref) return;
+        std::vector<Node*> stack(1, x);
+        while (!stack.empty()) {
+            Node *y = stack.back();
+            stack.pop_back();
+            for (Node *c : y->s) {
+                if (c && !--c->ref) stack.push_back(c);
+            }
+            freeNode(y);
+        }
+    }
+
+    /*
+    Turn one reference to x into a node that only this reference sees, so that
+    it can be modified. Called top-down, so a node with a single reference
+    belongs to this set alone and is returned as it is.
+    */
+    static Node* own(Node *x) {
+        if (x->ref == 1) return x;
+        ESET_COUNT(copies);
+        Node *y = new Node(*x);
+        y->ref = 1;
+        y->item->ref++;
+        for (Node *c : y->s) if (c) c->ref++;
+        x->ref--;
+        return y;
+    }
+
+    // h must already be owned, as in every function below.
+    static Node* rotate(Node *h, int t) {
+        ESET_COUNT(rotations);
+        Node *x = own(h->s[t^1]);
+        h->s[t^1] = x->s[t];
+        x->s[t] = h;
+        x->red = h->red;
+        h->red = true;
+        x->size = h->size;
+        update(h);
+        return x;
+    }
+
+    static void flipColors(Node *h) {
+        ESET_COUNT(recolors);
+        h->s[0] = own(h->s[0]);
+        h->s[1] = own(h->s[1]);
+        h->red = !h->red;
+        h->s[0]->red = !h->s[0]->red;
+        h->s[1]->red = !h->s[1]->red;
+    }
+
+    static Node* balance(Node *h) {
+        if (isRed(h->s[1]) && !isRed(h->s[0])) h = rotate(h, 0);
+        if (isRed(h->s[0]) && isRed(h->s[0]->s[0])) h = rotate(h, 1);
+        if (isRed(h->s[0]) && isRed(h->s[1])) flipColors(h);
+        update(h);
+        return h;
+    }
+
+    static Node* moveRedLeft(Node *h) {
+        flipColors(h);
+        if (isRed(h->s[1]->s[0])) {
+            h->s[1] = rotate(h->s[1], 1);
+            h = rotate(h, 0);
+            flipColors(h);
+        }
+        return h;
+    }
+
+    static Node* moveRedRight(Node *h) {
+        flipColors(h);
+        if (isRed(h->s[0]->s[0])) {
+            h = rotate(h, 1);
+            flipColors(h);
+        }
+        return h;
+    }
+
+    // The key of item must not be in the subtree.
+    Node* insert(Node *h, Item *item) {
+        if (!h) return new Node(item);
+        ESET_COUNT(visits);
+        h = own(h);
+        int t = !cmp(item->key, h->item->key);
+        h->s[t] = insert(h->s[t], item);
+        return balance(h);
+    }
+
+    static Node* eraseMin(Node *h) {
+        h = own(h);
+        if (!h->s[0]) {
+            freeNode(h);
+            return nullptr;
+        }
+        if (!isRed(h->s[0]) && !isRed(h->s[0]->s[0])) h = moveRedLeft(h);
+        h->s[0] = eraseMin(h->s[0]);
+        return balance(h);
+    }
+
+    // The key must be in the subtree.
+    template <class K>
+    Node* erase(Node *h, const K &key) {
+        ESET_COUNT(visits);
+        h = own(h);
+        if (cmp(key, h->item->key)) {
+            if (!isRed(h->s[0]) && !isRed(h->s[0]->s[0])) h = moveRedLeft(h);
+            h->s[0] = erase(h->s[0], key);
+        } else {
+            if (isRed(h->s[0])) h = rotate(h, 1);
+            if (!h->s[1] && !cmp(h->item->key, key)) {
+                freeNode(h);
+                return nullptr;
+            }
+            if (!isRed(h->s[1]) && !isRed(h->s[1]->s[0])) h = moveRedRight(h);
+            if (!cmp(h->item->key, key)) {
+                const Node *m = h->s[1];
+                for (; m->s[0]; m = m->s[0]);
+                m->item->ref++;
+                dropItem(h->item);
+                h->item = m->item;
+                h->s[1] = eraseMin(h->s[1]);
+            } else h->s[1] = erase(h->s[1], key);
+        }
+        return balance(h);
+    }
+
+    template <class K>
+    const Node* nfind(const K &key) const {
+        ESET_COUNT(descents);
+        for (const Node *p = root; p; ) {
+            ESET_COUNT(visits);
+            int c = order(key, p->item->key);
+            if (c < 0) {
                 p = p->s[0];
-            } else if (cmp(*p->key, key)) {
+            } else if (c > 0) {
                 p = p->s[1];
-            } else return iterator(p, this);
+            } else return p;
         }
-        return end();
+        return nullptr;
     }
 
-    void clear() noexcept {
-        if (root!=nullptr && root!=nil) recollect(root);
+    // The smallest key above key (strictly, or not below it if !strict).
+    template <class K>
+    const Item* findAbove(const K &key, bool strict) const {
+        const Item *ret = nullptr;
+        ESET_COUNT(descents);
+        for (const Node *p = root; p; ) {
+            ESET_COUNT(visits);
+            if (strict ? cmp(key, p->item->key) : !cmp(p->item->key, key)) {
+                ret = p->item;
+                p = p->s[0];
+            } else p = p->s[1];
+        }
+        return ret;
     }
 
-    size_t range(const Key &l, const Key &r) const {
-        if (cmp(r, l)) return 0;
-        size_t sizel = 0, sizer = 0;
-        Node *p;
-        for (p = root; p!=nil; ) {
-            if (cmp(*p->key, l)) {
-                sizel += p->s[0]->size+1;
+    // The largest key strictly below key.
+    template <class K>
+    const Item* findBelow(const K &key) const {
+        const Item *ret = nullptr;
+        ESET_COUNT(descents);
+        for (const Node *p = root; p; ) {
+            ESET_COUNT(visits);
+            if (cmp(p->item->key, key)) {
+                ret = p->item;
                 p = p->s[1];
             } else p = p->s[0];
         }
-        for (p = root; p!=nil; ) {
-            if (!cmp(r, *p->key)) {
-                sizer += p->s[0]->size+1;
+        return ret;
+    }
+
+    const Item* findEnd(int t) const {
+        const Node *p = root;
+        for (; p && p->s[t]; p = p->s[t]);
+        return p ? p->item : nullptr;
+    }
+
+    const Item* findNth(size_t k) const {
+        ESET_COUNT(descents);
+        for (const Node *p = root; p; ) {
+            ESET_COUNT(visits);
+            size_t l = getSize(p->s[0]);
+            if (k < l) {
+                p = p->s[0];
+            } else if (k > l) {
+                k -= l + 1;
+                p = p->s[1];
+            } else return p->item;
+        }
+        return nullptr;
+    }
+
+    // Number of keys strictly below key.
+    template <class K>
+    size_t position(const K &key) const {
+        size_t cnt = 0;
+        ESET_COUNT(descents);
+        for (const Node *p = root; p; ) {
+            ESET_COUNT(visits);
+            if (cmp(p->item->key, key)) {
+                cnt += getSize(p->s[0]) + 1;
                 p = p->s[1];
             } else p = p->s[0];
         }
-        return sizer - sizel;
+        return cnt;
     }
 
-    size_t size() const noexcept {
-        return root->size;
+    #ifdef DEBUG
+    void debug_print(const Node *ptr, int x) const {
+        if (!ptr) return;
+        std::cerr << x << ": " << (ptr->red ? "red" : "black") << ", size: " << ptr->size << ", ref: " << ptr->ref << ", key: " << ptr->item->key << "\n";
+        debug_print(ptr->s[0], x*2);
+        debug_print(ptr->s[1], x*2+1);
     }
+    #endif
 
-    iterator lower_bound(const Key &key) const {
-        Node *p = root, *ret = nil;
-        for (; p!=nil; ) {
-            if (p->s[0]!=nil && !cmp(*p->s[0]->key, key)) {
-                p = p->s[0];
-            } else if (!cmp(*p->key, key)) {
-                ret = p;
-                p = p->s[0];
-            } else p = p->s[1];
+public:
+    class iterator {
+        friend class ESet;
+    private:
+        const ESet *from;
+        const Item *item;
+
+        iterator(const Item *item, const ESet *from) : from{from}, item{item} {}
+
+    public:
+        iterator() : from{nullptr}, item{nullptr} {}
+
+        const Key& operator*() const {
+            if (!item) throw std::out_of_range("Out of range");
+            return item->key;
+        }
+
+        const Key* operator->() const {
+            if (!item) throw std::out_of_range("Out of range");
+            return &item->key;
+        }
+
+        iterator& operator++() {
+            if (item) item = from->findAbove(item->key, true);
+            return *this;
+        }
+
+        iterator& operator--() {
+            const Item *tmp = item ? from->findBelow(item->key) : from->findEnd(1);
+            if (tmp) item = tmp;
+            return *this;
+        }
+
+        // Moves k positions in O(log n), stopping at begin() or end().
+        iterator& operator+=(std::ptrdiff_t k) {
+            if (!from) return *this;
+            size_t i = item ? from->position(item->key) : from->size();
+            if (k < 0) i = size_t(-k) < i ? i + k : 0;
+            else i += k;
+            item = from->findNth(i);
+            return *this;
+        }
+
+        iterator& operator-=(std::ptrdiff_t k) {
+            return *this += -k;
+        }
+
+        iterator operator+(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp += k;
+        }
+
+        iterator operator-(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp -= k;
+        }
+
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        iterator operator--(int) {
+            iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const iterator &other) const {
+            return from == other.from && item == other.item;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return from != other.from || item != other.item;
+        }
+    };
+
+    ESet() : root{nullptr} {}
+
+    ~ESet() {
+        release(root);
+    }
+
+    ESet(const ESet &other) : root{other.root} {
+        if (root) root->ref++;
+    }
+
+    ESet& operator=(const ESet &other) {
+        if (&other == this) return *this;
+        if (other.root) other.root->ref++;
+        release(root);
+        root = other.root;
+        return *this;
+    }
+
+    ESet(ESet &&other) noexcept : root{other.root} {
+        other.root = nullptr;
+    }
+
+    ESet& operator=(ESet &&other) noexcept {
+        if (&other == this) return *this;
+        release(root);
+        root = other.root;
+        other.root = nullptr;
+        return *this;
+    }
+
+private:
+    std::pair<iterator, bool> insert(Item *item) {
+        ESET_COUNT(descents);
+        root = insert(root, item);
+        root->red = false;
+        return std::make_pair(iterator(item, this), true);
+    }
+
+    template <class K>
+    std::pair<iterator, bool> emplaceKey(std::true_type, K &&key) {
+        if (const Node *p = nfind(key)) return std::make_pair(iterator(p->item, this), false);
+        return insert(new Item(std::forward<K>(key)));
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplaceKey(std::false_type, Args &&... args) {
+        Item *item = new Item(std::forward<Args>(args)...);
+        if (const Node *p = nfind(item->key)) {
+            delete item;
+            return std::make_pair(iterator(p->item, this), false);
         }
-        return iterator(ret, this);
+        return insert(item);
     }
 
-    iterator upper_bound(const Key &key) const {
-        Node *p = root, *ret=nil;
-        for (; p!=nil; ) {
-            if (p->s[0]!=nil && cmp(key, *p->s[0]->key)) {
-                p = p->s[0];
-            } else if (cmp(key, *p->key)) {
-                ret = p;
+public:
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        return emplaceKey(ESetEmplaceLookup<Compare, Key, Args...>(), std::forward<Args>(args)...);
+    }
+
+    size_t erase(const Key &key) {
+        return erase<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t erase(const K &key) {
+        if (!nfind(key)) return 0;
+        root = own(root);
+        if (!isRed(root->s[0]) && !isRed(root->s[1])) root->red = true;
+        ESET_COUNT(descents);
+        root = erase(root, key);
+        if (root) root->red = false;
+        return 1;
+    }
+
+    iterator find(const Key &key) const {
+        return find<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator find(const K &key) const {
+        const Node *p = nfind(key);
+        return iterator(p ? p->item : nullptr, this);
+    }
+
+    void clear() noexcept {
+        release(root);
+        root = nullptr;
+    }
+
+    size_t range(const Key &l, const Key &r) const {
+        return range<Key>(l, r);
+    }
+
+    // Descends together until the paths to l and r part, then follows each.
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t range(const K &l, const K &r) const {
+        if (cmp(r, l)) return 0;
+        const Node *p = root;
+        ESET_COUNT(descents);
+        for (; p; ) {
+            ESET_COUNT(visits);
+            if (cmp(p->item->key, l)) {
+                p = p->s[1];
+            } else if (cmp(r, p->item->key)) {
                 p = p->s[0];
-            } else p = p->s[1];
+            } else break;
+        }
+        if (!p) return 0;
+        size_t cnt = 1;
+        for (const Node *q = p->s[0]; q; ) {
+            ESET_COUNT(visits);
+            if (!cmp(q->item->key, l)) {
+                cnt += getSize(q->s[1]) + 1;
+                q = q->s[0];
+            } else q = q->s[1];
+        }
+        for (const Node *q = p->s[1]; q; ) {
+            ESET_COUNT(visits);
+            if (!cmp(r, q->item->key)) {
+                cnt += getSize(q->s[0]) + 1;
+                q = q->s[1];
+            } else q = q->s[0];
         }
-        return iterator(ret, this);
+        return cnt;
+    }
+
+    // The k-th smallest key, counting from 0, or end() if k >= size().
+    iterator nth(size_t k) const {
+        return iterator(findNth(k), this);
+    }
+
+    // Number of keys less than key.
+    size_t rank(const Key &key) const {
+        return position(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t rank(const K &key) const {
+        return position(key);
+    }
+
+    size_t size() const noexcept {
+        return getSize(root);
+    }
+
+    iterator lower_bound(const Key &key) const {
+        return iterator(findAbove(key, false), this);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator lower_bound(const K &key) const {
+        return iterator(findAbove(key, false), this);
+    }
+
+    iterator upper_bound(const Key &key) const {
+        return iterator(findAbove(key, true), this);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator upper_bound(const K &key) const {
+        return iterator(findAbove(key, true), this);
     }
 
     iterator begin() const noexcept {
-        Node *p = root;
-        for (; p!=nil && p->s[0]!=nil; p = p->s[0]);
-        return iterator(p, this);
+        return iterator(findEnd(0), this);
     }
 
     iterator end() const noexcept {
-        return iterator(nil, this);
+        return iterator(nullptr, this);
     }
 
-    // const_iterator cbegin() const noexcept {
-    //     return const_iterator(begin());
-    // }
-
-    // const_iterator cend() const noexcept {
-    //     return const_iterator(end());
-    // }
+    #ifdef DEBUG
+    void debug_print() const {
+        debug_print(root, 1);
+    }
+    #endif
 };
 
-#endif // ESET_H
\ No newline at end of file
+} // namespace eset::rbtree
+
+#if !defined(ESET_NO_GLOBAL) && !defined(ESET_GLOBAL_DEFINED)
+#define ESET_GLOBAL_DEFINED
+template <class Key, class Compare = std::less<Key>, bool Persistent = false>
+using ESet = eset::rbtree::ESet<Key, Compare, Persistent>;
+#endif
+
+#endif // ESET_RBTREE_HPP
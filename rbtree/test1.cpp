@@ -2,6 +2,11 @@
 #include <set>
 #include <iostream>
 #include <random>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <string_view>
 
 // Test for basic insert and enumerate
 void test1() {
@@ -130,6 +135,207 @@ void test6() {
     }
 }
 
+// Whether s holds exactly the keys of t, in order
+template <class T>
+bool same(const ESet<int> &s, const T &t) {
+    if (s.size() != t.size()) return false;
+    auto x = s.begin();
+    auto y = t.begin();
+    for (; x!=s.end() && y!=t.end(); ++x, ++y) {
+        if (*x != *y) return false;
+    }
+    return x == s.end() && y == t.end();
+}
+
+// Randomly combine two sets, checking against the set algorithms of <algorithm>
+void test8() {
+    std::cout << "test8:" << std::endl;
+    const int M = 200;
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> dist(0, M), dist2(0, 3);
+    for (int i=0; i<5000; i++) {
+        ESet<int> s1, s2;
+        std::set<int> t1, t2;
+        int n1 = dist(rng), n2 = dist(rng);
+        for (int j=0; j<n1; j++) {
+            int x = dist(rng);
+            s1.emplace(x), t1.emplace(x);
+        }
+        for (int j=0; j<n2; j++) {
+            int x = dist(rng);
+            s2.emplace(x), t2.emplace(x);
+        }
+        std::vector<std::pair<ESet<int>::iterator, int>> its;
+        for (auto it = s1.begin(); it != s1.end(); ++it) its.emplace_back(it, *it);
+
+        std::vector<int> r;
+        switch (dist2(rng)) {
+        case 0:
+            s1.union_with(s2);
+            std::set_union(t1.begin(), t1.end(), t2.begin(), t2.end(), std::back_inserter(r));
+            break;
+        case 1:
+            s1.intersect_with(s2);
+            std::set_intersection(t1.begin(), t1.end(), t2.begin(), t2.end(), std::back_inserter(r));
+            break;
+        case 2:
+            s1.difference_with(s2);
+            std::set_difference(t1.begin(), t1.end(), t2.begin(), t2.end(), std::back_inserter(r));
+            break;
+        default:
+            s1.symmetric_difference(s2);
+            std::set_symmetric_difference(t1.begin(), t1.end(), t2.begin(), t2.end(), std::back_inserter(r));
+        }
+
+        if (!same(s1, r) || !same(s2, t2)) {
+            std::cout << "error" << std::endl;
+        }
+        // Iterators to the keys that stayed still point to them
+        for (auto &p : its) {
+            if (std::binary_search(r.begin(), r.end(), p.second) && (*p.first != p.second || s1.find(p.second) != p.first)) {
+                std::cout << "error" << std::endl;
+            }
+        }
+    }
+
+    ESet<int> s;
+    for (int i=0; i<10; i++) s.emplace(i);
+    s.union_with(s);
+    s.intersect_with(s);
+    if (s.size() != 10) std::cout << "error" << std::endl;
+    s.difference_with(s);
+    if (s.size() != 0 || s.begin() != s.end()) std::cout << "error" << std::endl;
+}
+
+// Randomly insert and erase, checking nth, rank and iterator moves against std::set
+template <class S>
+void orderCheck() {
+    const int M = 50;
+    S s1;
+    std::set<int> s2;
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> dist(0, M);
+    std::bernoulli_distribution dist2(0.5);
+    for (int i=0; i<20000; i++) {
+        int x = dist(rng);
+        if (dist2(rng)) {
+            s1.emplace(x), s2.emplace(x);
+        } else {
+            s1.erase(x), s2.erase(x);
+        }
+        std::vector<int> v(s2.begin(), s2.end());
+        int n = v.size();
+
+        for (int k=0; k<=n+1; k++) {
+            auto it = s1.nth(k);
+            if (k >= n ? it != s1.end() : *it != v[k]) {
+                std::cout << "error" << std::endl;
+            }
+        }
+        for (int j=-1; j<=M+1; j++) {
+            if (s1.rank(j) != size_t(std::lower_bound(v.begin(), v.end(), j) - v.begin())) {
+                std::cout << "error" << std::endl;
+            }
+        }
+
+        // Moves stop at begin() and end()
+        int k = std::uniform_int_distribution<int>(0, n)(rng);
+        int d = std::uniform_int_distribution<int>(-n-2, n+2)(rng);
+        auto it = s1.nth(k), it2 = it;
+        it += d;
+        it2 -= d;
+        if (it != s1.nth(std::min(std::max(k+d, 0), n)) || it2 != s1.nth(std::min(std::max(k-d, 0), n))) {
+            std::cout << "error" << std::endl;
+        }
+        if (s1.nth(k) + d != it || s1.nth(k) - d != it2) {
+            std::cout << "error" << std::endl;
+        }
+    }
+    auto b = s1.begin(), e = s1.end();
+    b -= 3;
+    e += 3;
+    if (b != s1.begin() || e != s1.end()) {
+        std::cout << "error" << std::endl;
+    }
+    e -= 1;
+    if (s1.size() && *e != *s2.rbegin()) {
+        std::cout << "error" << std::endl;
+    }
+}
+
+// nth, rank and iterator moves
+void test9() {
+    std::cout << "test9:" << std::endl;
+    orderCheck<ESet<int>>();
+    orderCheck<ESet<int, std::less<int>, true>>();
+}
+
+// A string key that counts how many times one is constructed
+struct Name {
+    static int made;
+    std::string s;
+
+    Name(std::string_view v) : s(v) { made++; }
+    Name(const Name &other) : s(other.s) { made++; }
+    Name(Name &&other) : s(std::move(other.s)) { made++; }
+};
+
+int Name::made = 0;
+
+bool operator<(const Name &a, const Name &b) { return a.s < b.s; }
+bool operator<(const Name &a, std::string_view b) { return a.s < b; }
+bool operator<(std::string_view a, const Name &b) { return a < b.s; }
+
+// Lookups by std::string_view under std::less<>, and emplace of a key that is already there
+template <class S>
+void lookupCheck() {
+    S s1;
+    std::set<std::string> s2;
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> dist(0, 30);
+    std::bernoulli_distribution dist2(0.5);
+    for (int i=0; i<20000; i++) {
+        std::string k = std::to_string(dist(rng));
+        std::string_view v = k;
+        if (dist2(rng)) {
+            int made = Name::made;
+            bool fresh = s1.emplace(v).second;
+            if (fresh != s2.emplace(k).second || (!fresh && Name::made != made)) {
+                std::cout << "error" << std::endl;
+            }
+        } else {
+            int made = Name::made;
+            if (s1.erase(v) != s2.erase(k) || Name::made != made) {
+                std::cout << "error" << std::endl;
+            }
+        }
+
+        int made = Name::made;
+        auto it = s1.find(v);
+        if ((it == s1.end()) != (s2.find(k) == s2.end()) || (it != s1.end() && it->s != k)) {
+            std::cout << "error" << std::endl;
+        }
+        auto lb = s1.lower_bound(v), ub = s1.upper_bound(v);
+        auto lb2 = s2.lower_bound(k), ub2 = s2.upper_bound(k);
+        if ((lb == s1.end() ? lb2 != s2.end() : lb->s != *lb2) || (ub == s1.end() ? ub2 != s2.end() : ub->s != *ub2)) {
+            std::cout << "error" << std::endl;
+        }
+        if (s1.rank(v) != size_t(std::distance(s2.begin(), lb2)) || s1.range(std::string_view("1"), v) != (k < "1" ? 0 : size_t(std::distance(s2.lower_bound("1"), ub2)))) {
+            std::cout << "error" << std::endl;
+        }
+        if (Name::made != made) {
+            std::cout << "error" << std::endl;
+        }
+    }
+}
+
+// Heterogeneous lookup and emplace
+void test10() {
+    std::cout << "test10:" << std::endl;
+    lookupCheck<ESet<Name, std::less<>>>();
+    lookupCheck<ESet<Name, std::less<>, true>>();
+}
+
 struct Int {
     int v;
 };
@@ -172,5 +378,8 @@ int main() {
     test4();
     // test5();
     test6();
+    test8();
+    test9();
+    test10();
     return 0;
 }
\ No newline at end of file
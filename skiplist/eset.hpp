@@ -0,0 +1,603 @@
+#ifndef ESET_SKIPLIST_HPP
+#define ESET_SKIPLIST_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus > 201703L
+#include <compare>
+#endif
+
+#ifdef DEBUG
+#include <iostream>
+#include <string>
+#endif
+
+#include "../common/eset_common.hpp"
+
+namespace eset::skiplist {
+
+/*
+Skip list with spans: every forward link also records how many keys it
+skips, so nth, rank and range take O(log n) expected like a search. Level 0
+is doubly linked for O(1) iterator steps both ways.
+
+A node is allocated together with its tower of links, from a pool that
+keeps one free list per tower height.
+*/
+template <typename Key, typename Compare = std::less<Key>>
+class ESet {
+private:
+    // A tower grows one more level with probability 1/4, so 16 levels cover 2^32 keys.
+    static constexpr int MAX_LEVEL = 16;
+
+    struct Node;
+
+    struct Link {
+        Node *next;
+        size_t span;    // keys passed by following next, or keys after this node if next is null
+    };
+
+    struct Node {
+        Key key;
+        Node *prev;
+        int height;
+
+        Link* links() {
+            return reinterpret_cast<Link*>(this + 1);
+        }
+
+        const Link* links() const {
+            return reinterpret_cast<const Link*>(this + 1);
+        }
+    };
+
+    class NodePool {
+    private:
+        static constexpr size_t MIN_CHUNK = 1 << 12, MAX_CHUNK = 1 << 20;
+
+        struct Free {
+            Free *next;
+        };
+
+        std::vector<std::pair<char*, size_t>> chunks;
+        Free *freed[MAX_LEVEL + 1];
+        char *cur;
+        size_t left, total, used;   // chunks[0, used) are being carved up
+
+        // Moves on to a chunk with room for n bytes, reusing one after reset() if possible.
+        void grow(size_t n) {
+            for (; used < chunks.size(); used++) {
+                if (chunks[used].second >= n) {
+                    cur = chunks[used].first;
+                    left = chunks[used++].second;
+                    return;
+                }
+            }
+            n = std::max(n, total < MIN_CHUNK ? MIN_CHUNK : total < MAX_CHUNK ? total : MAX_CHUNK);
+            char *chunk = static_cast<char*>(::operator new(n, std::align_val_t(alignof(Node))));
+            chunks.emplace_back(chunk, n);
+            cur = chunk;
+            left = n;
+            total += n;
+            used = chunks.size();
+        }
+
+    public:
+        // Bytes of a node with h links, rounded up so the next node stays aligned.
+        static constexpr size_t bytes(int h) {
+            size_t n = sizeof(Node) + h * sizeof(Link);
+            return (n + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+        }
+
+        NodePool() : cur{nullptr}, left{0}, total{0}, used{0} {
+            std::fill(freed, freed + MAX_LEVEL + 1, nullptr);
+        }
+
+        NodePool(const NodePool &) = delete;
+        NodePool& operator=(const NodePool &) = delete;
+
+        ~NodePool() {
+            clear();
+        }
+
+        // Raw storage for a node of height h, to be constructed by the caller.
+        void* allocate(int h) {
+            if (Free *x = freed[h]) {
+                freed[h] = x->next;
+                return x;
+            }
+            size_t n = bytes(h);
+            if (left < n) grow(n);
+            void *x = cur;
+            cur += n;
+            left -= n;
+            return x;
+        }
+
+        // The key must already be destroyed.
+        void deallocate(Node *x, int h) {
+            freed[h] = new (static_cast<void*>(x)) Free{freed[h]};
+        }
+
+        void clear() {
+            for (auto &c : chunks) ::operator delete(c.first, std::align_val_t(alignof(Node)));
+            chunks.clear();
+            std::fill(freed, freed + MAX_LEVEL + 1, nullptr);
+            cur = nullptr;
+            left = total = used = 0;
+        }
+
+        // Drop every node but keep the chunks for the next ones.
+        void reset() {
+            std::fill(freed, freed + MAX_LEVEL + 1, nullptr);
+            cur = nullptr;
+            left = used = 0;
+        }
+
+        void swap(NodePool &other) {
+            chunks.swap(other.chunks);
+            std::swap_ranges(freed, freed + MAX_LEVEL + 1, other.freed);
+            std::swap(cur, other.cur);
+            std::swap(left, other.left);
+            std::swap(total, other.total);
+            std::swap(used, other.used);
+        }
+    };
+
+    NodePool pool;
+    Node *head;     // no key, MAX_LEVEL links
+    Node *last;
+    int level;      // levels in use
+    size_t total;
+    std::mt19937 gen;
+    ESET_COMPARE(Compare) cmp;
+
+    int randomHeight() {
+        unsigned r = gen();
+        int h = 1;
+        for (; h < MAX_LEVEL && !(r & 3); r >>= 2) h++;
+        return h;
+    }
+
+    void makeHead() {
+        head = static_cast<Node*>(pool.allocate(MAX_LEVEL));
+        head->prev = nullptr;
+        head->height = MAX_LEVEL;
+        for (int i = 0; i < MAX_LEVEL; i++) head->links()[i] = Link{nullptr, 0};
+        last = nullptr;
+        level = 1;
+        total = 0;
+    }
+
+    template <class... Args>
+    Node* newNode(int h, Args &&... args) {
+        void *p = pool.allocate(h);
+        Node *x;
+        try {
+            x = new (p) Node{Key(std::forward<Args>(args)...), nullptr, h};
+        } catch (...) {
+            pool.deallocate(static_cast<Node*>(p), h);
+            throw;
+        }
+        return x;
+    }
+
+    void dropNode(Node *x) {
+        int h = x->height;
+        x->~Node();
+        pool.deallocate(x, h);
+    }
+
+    void destroyKeys() {
+        if (std::is_trivially_destructible<Key>::value) return;
+        for (Node *x = head->links()[0].next; x; ) {
+            Node *y = x->links()[0].next;
+            x->~Node();
+            x = y;
+        }
+    }
+
+    /*
+    The last node before key on every level, below key (or not above it if
+    upper), with the rank of each: the number of keys up to and including it.
+    */
+    template <class K>
+    void descend(const K &key, bool upper, Node **update, size_t *rank) const {
+        ESET_COUNT(descents);
+        Node *x = head;
+        size_t r = 0;
+        // level is at least 1, but the compiler cannot see that update[0] gets set.
+        update[0] = head;
+        rank[0] = 0;
+        for (int i = level - 1; i >= 0; i--) {
+            for (Node *y; (y = x->links()[i].next) && (upper ? !cmp(key, y->key) : cmp(y->key, key)); x = y) {
+                ESET_COUNT(visits);
+                r += x->links()[i].span;
+            }
+            update[i] = x;
+            rank[i] = r;
+        }
+    }
+
+    // The first key not below key, or above it if strict.
+    template <class K>
+    const Node* findAbove(const K &key, bool strict) const {
+        Node *update[MAX_LEVEL];
+        size_t rank[MAX_LEVEL];
+        descend(key, strict, update, rank);
+        return update[0]->links()[0].next;
+    }
+
+    template <class K>
+    const Node* nfind(const K &key) const {
+        const Node *x = findAbove(key, false);
+        return x && !cmp(key, x->key) ? x : nullptr;
+    }
+
+    template <class K>
+    size_t position(const K &key) const {
+        Node *update[MAX_LEVEL];
+        size_t rank[MAX_LEVEL];
+        descend(key, false, update, rank);
+        return rank[0];
+    }
+
+    const Node* findNth(size_t k) const {
+        if (k >= total) return nullptr;
+        ESET_COUNT(descents);
+        const Node *x = head;
+        size_t r = 0;
+        for (int i = level - 1; i >= 0; i--) {
+            for (; x->links()[i].next && r + x->links()[i].span <= k + 1; x = x->links()[i].next) {
+                ESET_COUNT(visits);
+                r += x->links()[i].span;
+            }
+            if (r == k + 1) return x;
+        }
+        return x;
+    }
+
+    const Node* findPrev(const Node *x) const {
+        return x->prev == head ? nullptr : x->prev;
+    }
+
+    // Links the new node x after update[i] on each of its levels.
+    void insert(Node *x, Node **update, size_t *rank) {
+        int h = x->height;
+        if (h > level) {
+            for (int i = level; i < h; i++) {
+                update[i] = head;
+                rank[i] = 0;
+                head->links()[i].span = total;
+            }
+            level = h;
+        }
+        for (int i = 0; i < h; i++) {
+            Link &l = update[i]->links()[i];
+            x->links()[i] = Link{l.next, l.span - (rank[0] - rank[i])};
+            l = Link{x, rank[0] - rank[i] + 1};
+        }
+        for (int i = h; i < level; i++) update[i]->links()[i].span++;
+        x->prev = update[0];
+        if (Node *y = x->links()[0].next) y->prev = x;
+        else last = x;
+        total++;
+    }
+
+    // Appends a node with the same height as x, for copies.
+    void append(const Node *x, Node **ends, size_t *rank) {
+        Node *y = newNode(x->height, x->key);
+        size_t r = ++total;
+        for (int i = 0; i < y->height; i++) {
+            ends[i]->links()[i] = Link{y, r - rank[i]};
+            y->links()[i] = Link{nullptr, 0};
+            ends[i] = y;
+            rank[i] = r;
+        }
+        y->prev = last ? last : head;
+        last = y;
+        level = std::max(level, y->height);
+    }
+
+    void copyFrom(const ESet &other) {
+        Node *ends[MAX_LEVEL];
+        size_t rank[MAX_LEVEL];
+        std::fill(ends, ends + MAX_LEVEL, head);
+        std::fill(rank, rank + MAX_LEVEL, 0);
+        for (const Node *x = other.head->links()[0].next; x; x = x->links()[0].next) append(x, ends, rank);
+        for (int i = 0; i < level; i++) ends[i]->links()[i].span = total - rank[i];
+    }
+
+public:
+    class iterator {
+        friend class ESet;
+    private:
+        const ESet *from;
+        const Node *ptr;
+
+        iterator(const Node *ptr, const ESet *from) : from{from}, ptr{ptr} {}
+
+    public:
+        iterator() : from{nullptr}, ptr{nullptr} {}
+
+        const Key& operator*() const {
+            if (!ptr) throw std::out_of_range("Out of range");
+            return ptr->key;
+        }
+
+        const Key* operator->() const {
+            if (!ptr) throw std::out_of_range("Out of range");
+            return &ptr->key;
+        }
+
+        // Along level 0, O(1).
+        iterator& operator++() {
+            if (ptr) ptr = ptr->links()[0].next;
+            return *this;
+        }
+
+        iterator& operator--() {
+            if (!from) return *this;
+            const Node *tmp = ptr ? from->findPrev(ptr) : from->last;
+            if (tmp) ptr = tmp;
+            return *this;
+        }
+
+        // Moves k positions in O(log n), stopping at begin() or end().
+        iterator& operator+=(std::ptrdiff_t k) {
+            if (!from) return *this;
+            size_t i = ptr ? from->position(ptr->key) : from->size();
+            if (k < 0) i = size_t(-k) < i ? i + k : 0;
+            else i += k;
+            ptr = from->findNth(i);
+            return *this;
+        }
+
+        iterator& operator-=(std::ptrdiff_t k) {
+            return *this += -k;
+        }
+
+        iterator operator+(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp += k;
+        }
+
+        iterator operator-(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp -= k;
+        }
+
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        iterator operator--(int) {
+            iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const iterator &other) const {
+            return from == other.from && ptr == other.ptr;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return from != other.from || ptr != other.ptr;
+        }
+    };
+
+    ESet() {
+        makeHead();
+    }
+
+    ~ESet() {
+        destroyKeys();
+    }
+
+    ESet(const ESet &other) : gen{other.gen}, cmp{other.cmp} {
+        makeHead();
+        copyFrom(other);
+    }
+
+    ESet& operator=(const ESet &other) {
+        if (&other == this) return *this;
+        // Like clear(), but the chunks of the old nodes are reused for the copy.
+        destroyKeys();
+        pool.reset();
+        makeHead();
+        copyFrom(other);
+        return *this;
+    }
+
+    // The moved-from set is left empty, with a head of its own.
+    ESet(ESet &&other) noexcept : gen{other.gen}, cmp{other.cmp} {
+        makeHead();
+        swap(other);
+    }
+
+    ESet& operator=(ESet &&other) noexcept {
+        if (&other == this) return *this;
+        swap(other);
+        return *this;
+    }
+
+    void swap(ESet &other) noexcept {
+        pool.swap(other.pool);
+        std::swap(head, other.head);
+        std::swap(last, other.last);
+        std::swap(level, other.level);
+        std::swap(total, other.total);
+    }
+
+private:
+    template <class K>
+    std::pair<iterator, bool> emplaceKey(std::true_type, K &&key) {
+        Node *update[MAX_LEVEL];
+        size_t rank[MAX_LEVEL];
+        descend(key, false, update, rank);
+        Node *y = update[0]->links()[0].next;
+        if (y && !cmp(key, y->key)) return std::make_pair(iterator(y, this), false);
+        Node *x = newNode(randomHeight(), std::forward<K>(key));
+        insert(x, update, rank);
+        return std::make_pair(iterator(x, this), true);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplaceKey(std::false_type, Args &&... args) {
+        Key key(std::forward<Args>(args)...);
+        return emplaceKey(std::true_type(), std::move(key));
+    }
+
+public:
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        return emplaceKey(ESetEmplaceLookup<Compare, Key, Args...>(), std::forward<Args>(args)...);
+    }
+
+    size_t erase(const Key &key) {
+        return erase<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t erase(const K &key) {
+        Node *update[MAX_LEVEL];
+        size_t rank[MAX_LEVEL];
+        descend(key, false, update, rank);
+        Node *x = update[0]->links()[0].next;
+        if (!x || cmp(key, x->key)) return 0;
+        for (int i = 0; i < level; i++) {
+            Link &l = update[i]->links()[i];
+            if (l.next == x) l = Link{x->links()[i].next, l.span + x->links()[i].span - 1};
+            else l.span--;
+        }
+        if (Node *y = x->links()[0].next) y->prev = x->prev;
+        else last = x->prev == head ? nullptr : x->prev;
+        for (; level > 1 && !head->links()[level - 1].next; level--);
+        total--;
+        dropNode(x);
+        return 1;
+    }
+
+    iterator find(const Key &key) const {
+        return find<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator find(const K &key) const {
+        return iterator(nfind(key), this);
+    }
+
+    void clear() noexcept {
+        destroyKeys();
+        pool.clear();
+        makeHead();
+    }
+
+    size_t range(const Key &l, const Key &r) const {
+        return range<Key>(l, r);
+    }
+
+    /*
+    Rank of r minus rank of l. The search for r starts, on every level, from
+    where the one for l stopped, so it only walks the gap between them.
+    */
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t range(const K &l, const K &r) const {
+        if (cmp(r, l)) return 0;
+        Node *update[MAX_LEVEL];
+        size_t rank[MAX_LEVEL];
+        descend(l, false, update, rank);
+        const Node *x = head;
+        size_t c = 0;
+        for (int i = level - 1; i >= 0; i--) {
+            if (rank[i] > c) {
+                x = update[i];
+                c = rank[i];
+            }
+            for (const Node *y; (y = x->links()[i].next) && !cmp(r, y->key); x = y) {
+                ESET_COUNT(visits);
+                c += x->links()[i].span;
+            }
+        }
+        return c - rank[0];
+    }
+
+    // The k-th smallest key, counting from 0, or end() if k >= size().
+    iterator nth(size_t k) const {
+        return iterator(findNth(k), this);
+    }
+
+    // Number of keys less than key.
+    size_t rank(const Key &key) const {
+        return rank<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t rank(const K &key) const {
+        return position(key);
+    }
+
+    size_t size() const noexcept {
+        return total;
+    }
+
+    iterator lower_bound(const Key &key) const {
+        return lower_bound<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator lower_bound(const K &key) const {
+        return iterator(findAbove(key, false), this);
+    }
+
+    iterator upper_bound(const Key &key) const {
+        return upper_bound<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator upper_bound(const K &key) const {
+        return iterator(findAbove(key, true), this);
+    }
+
+    iterator begin() const noexcept {
+        return iterator(head->links()[0].next, this);
+    }
+
+    iterator end() const noexcept {
+        return iterator(nullptr, this);
+    }
+
+    #ifdef DEBUG
+    // One line per level, each link followed by its span.
+    void debug_print() const {
+        for (int i = level - 1; i >= 0; i--) {
+            std::cerr << i << ":";
+            for (const Node *x = head; x; x = x->links()[i].next) {
+                if (x != head) std::cerr << " " << x->key;
+                std::cerr << " (" << x->links()[i].span << ")";
+            }
+            std::cerr << "\n";
+        }
+    }
+    #endif
+};
+
+} // namespace eset::skiplist
+
+#if !defined(ESET_NO_GLOBAL) && !defined(ESET_GLOBAL_DEFINED)
+#define ESET_GLOBAL_DEFINED
+template <class Key, class Compare = std::less<Key>>
+using ESet = eset::skiplist::ESet<Key, Compare>;
+#endif
+
+#endif // ESET_SKIPLIST_HPP
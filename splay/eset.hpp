@@ -1,44 +1,90 @@
-#ifndef ESET_HPP
+#ifndef ESET_SPLAY_HPP
 
-#define ESET_HPP
+#define ESET_SPLAY_HPP
 
+#include <cstddef>
+#include <functional>
 #include <stdexcept>
-
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus > 201703L
+#include <compare>
+#endif
 #ifdef DEBUG
 #include <iostream>
 #endif
 
-// namespace splay {
+#include "../common/eset_common.hpp"
+#include "../common/node_pool.hpp"
+
+namespace eset::splay {
     template <typename Key, typename Compare = std::less<Key>>
     class ESet {
 
     private:
         struct Node {
-            const Key *key;
             int size;
             mutable Node *s[2], *fa;
+            union {
+                Key key;
+            };
 
-            Node() : key(nullptr), size(0), s{nullptr, nullptr}, fa(nullptr) {}
-            Node(const Key *key) : key(key), size(1), s{nullptr, nullptr}, fa(nullptr) {}
+            Node() : size(1), s{nullptr, nullptr}, fa(nullptr) {}
 
             void link(int t, Node *x) {
                 s[t] = x;
                 if (x) x->fa = this;
             }
 
-            ~Node() {
-                if (key) delete key;
-            }
+            ~Node() {}
         };
 
-        Compare cmp;
+        ESET_COMPARE(Compare) cmp;
         mutable Node *root;
+        ESetNodePool<Node> pool;
+
+        // cmp as a three-way comparison, see ESetOrder.
+        int order(const Key &a, const Key &b) const {
+            return ESetOrder<Compare, Key>::compare(cmp, a, b);
+        }
 
+        // Other key types go through the transparent comparator, twice.
+        template <class A, class B>
+        int order(const A &a, const B &b) const {
+            if (cmp(a, b)) return -1;
+            return cmp(b, a);
+        }
+
+        // Destroys the keys only, flattening the tree with right rotations instead of recursing.
         void recollect(Node *x) {
-            if (!x) return;
-            recollect(x->s[0]);
-            recollect(x->s[1]);
-            delete x;
+            if (std::is_trivially_destructible<Key>::value) return;
+            while (x) {
+                if (x->s[0]) {
+                    Node *y = x->s[0];
+                    x->s[0] = y->s[1];
+                    y->s[1] = x;
+                    x = y;
+                } else {
+                    x->key.~Key();
+                    x = x->s[1];
+                }
+            }
+        }
+
+        template <class... Args>
+        Node* newNode(Args&&... args) {
+            Node *x = pool.allocate();
+            new (&x->key) Key(std::forward<Args>(args)...);
+            return x;
+        }
+
+        void freeNode(Node *x) {
+            x->key.~Key();
+            pool.deallocate(x);
         }
 
         int dir(Node *x) const {
@@ -61,6 +107,7 @@
         }
 
         void rotate(Node *x) const {
+            ESET_COUNT(rotations);
             int t = dir(x);
             Node *y = x->fa, *z = y->fa;
             if (z) z->link(dir(y), x);
@@ -77,29 +124,37 @@
 
         void splay(Node *x, Node *y) const {
             for (; x->fa != y; ) {
+                ESET_COUNT(splays);
                 if (x->fa->fa != y && dir(x) == dir(x->fa)) rotate(x->fa);
                 rotate(x);
             }
             if (!y) root = x;
         }
 
-        Node* nfind(const Key &key) const {
+        template <class K>
+        Node* nfind(const K &key) const {
             Node *x;
+            ESET_COUNT(descents);
             for (x = root; x; ) {
-                if (cmp(key, *x->key)) {
+                ESET_COUNT(visits);
+                int c = order(key, x->key);
+                if (c < 0) {
                     x = x->s[0];
-                } else if (cmp(*x->key, key)) {
+                } else if (c > 0) {
                     x = x->s[1];
                 } else break;
             }
             return x;
         }
 
-        Node* nlower_bound(const Key &key) const {
+        template <class K>
+        Node* nlower_bound(const K &key) const {
             if (!root) return nullptr;
             Node *x, *tar = nullptr;
+            ESET_COUNT(descents);
             for (x=root; x; ) {
-                if (!cmp(*x->key, key)) {
+                ESET_COUNT(visits);
+                if (!cmp(x->key, key)) {
                     tar = x;
                     x = x->s[0];
                 } else x = x->s[1];
@@ -107,10 +162,13 @@
             return tar;
         }
 
-        Node* nupper_bound(const Key &key) const {
+        template <class K>
+        Node* nupper_bound(const K &key) const {
             Node *x, *tar = nullptr;
+            ESET_COUNT(descents);
             for(x=root; x; ) {
-                if (cmp(key, *x->key)) {
+                ESET_COUNT(visits);
+                if (cmp(key, x->key)) {
                     tar = x;
                     x = x->s[0];
                 } else x = x->s[1];
@@ -149,15 +207,58 @@
             return x;
         }
 
-        Node* clone(Node *x, const ESet &other) {
+        // The k-th smallest node, counting from 0, splayed to the root; null if there are not that many.
+        Node* findNth(size_t k) const {
+            Node *x = root;
+            ESET_COUNT(descents);
+            for (; x; ) {
+                ESET_COUNT(visits);
+                size_t l = getSize(x->s[0]);
+                if (k < l) {
+                    x = x->s[0];
+                } else if (k > l) {
+                    k -= l + 1;
+                    x = x->s[1];
+                } else break;
+            }
+            if (x) splay(x, nullptr);
+            return x;
+        }
+
+        // Number of nodes before x, which is splayed to the root; size() for null.
+        size_t position(Node *x) const {
+            if (!x) return getSize(root);
+            splay(x, nullptr);
+            return getSize(x->s[0]);
+        }
+
+        // Preorder copy that climbs back up through the parent pointers of both trees.
+        Node* clone(Node *x) {
             if (!x) return nullptr;
-            Node *y = new Node(new Key(*x->key));
-            y->s[0] = clone(x->s[0], other);
-            y->s[1] = clone(x->s[1], other);
-            if (y->s[0]) y->s[0]->fa = y;
-            if (y->s[1]) y->s[1]->fa = y;
-            update(y);
-            return y;
+            pool.reserve(x->size);
+            Node *top = newNode(x->key), *y = top;
+            y->size = x->size;
+            for (;;) {
+                if (x->s[0] && !y->s[0]) {
+                    y->link(0, newNode(x->s[0]->key));
+                    x = x->s[0], y = y->s[0];
+                    y->size = x->size;
+                } else if (x->s[1] && !y->s[1]) {
+                    y->link(1, newNode(x->s[1]->key));
+                    x = x->s[1], y = y->s[1];
+                    y->size = x->size;
+                } else if (y == top) {
+                    return top;
+                } else {
+                    x = x->fa, y = y->fa;
+                }
+            }
+        }
+
+        void clear() {
+            recollect(root);
+            pool.clear();
+            root = nullptr;
         }
 
     public:
@@ -175,12 +276,12 @@
 
             const Key& operator*() const { 
                 if (!ptr) throw std::out_of_range("Out of range");
-                return *ptr->key; 
+                return ptr->key; 
             }
 
             const Key* operator->() const { 
                 if (!ptr) throw std::out_of_range("Out of range");
-                return ptr->key; 
+                return &ptr->key; 
             }
 
             iterator& operator++() {
@@ -206,6 +307,30 @@
                 return tmp;
             }
 
+            // Moves k positions in O(log n) amortized, stopping at begin() or end().
+            iterator& operator+=(std::ptrdiff_t k) {
+                if (!from) return *this;
+                size_t i = from->position(ptr);
+                if (k < 0) i = size_t(-k) < i ? i + k : 0;
+                else i += k;
+                ptr = from->findNth(i);
+                return *this;
+            }
+
+            iterator& operator-=(std::ptrdiff_t k) {
+                return *this += -k;
+            }
+
+            iterator operator+(std::ptrdiff_t k) const {
+                iterator tmp = *this;
+                return tmp += k;
+            }
+
+            iterator operator-(std::ptrdiff_t k) const {
+                iterator tmp = *this;
+                return tmp -= k;
+            }
+
             bool operator==(const iterator &other) const {
                 return from == other.from && ptr == other.ptr;
             }
@@ -218,24 +343,27 @@
         ESet() : root{nullptr}, cmp{} {}
 
         ESet(const ESet &other) : root{nullptr}, cmp{} {
-            root = clone(other.root, other);
+            root = clone(other.root);
         }
 
         ESet& operator=(const ESet &other) {
             if (&other == this) return *this;
             recollect(root);
-            root = clone(other.root, other);
+            pool.reset(other.size());
+            root = clone(other.root);
             return *this;
         }
 
         ESet(ESet &&other) : root{std::move(other.root)}, cmp{} {
+            pool.swap(other.pool);
             other.root = nullptr;
         }
 
         ESet& operator=(ESet &&other) noexcept {
             if (&other == this) return *this;
-            recollect(root);
+            clear();
             root = std::move(other.root);
+            pool.swap(other.pool);
             other.root = nullptr;
             return *this;
         }
@@ -244,16 +372,18 @@
             recollect(root);
         }
 
-        template<class... Args>
-        std::pair<iterator, bool> emplace(Args&&... args) {
-            Key key = Key(std::forward<Args>(args)...);
+    private:
+        template <class K>
+        std::pair<iterator, bool> emplaceKey(std::true_type, K &&key) {
             if (!root) {
-                root = new Node(new Key(std::move(key)));
+                root = newNode(std::forward<K>(key));
                 return std::make_pair(iterator(root, this), true);
             }
             Node *x=nullptr, *y, *z;
+            ESET_COUNT(descents);
             for (Node *p = root; p; ) {
-                if (!cmp(key, *p->key)) {
+                ESET_COUNT(visits);
+                if (!cmp(key, p->key)) {
                     x = p;
                     p = p->s[1];
                 } else {
@@ -262,15 +392,16 @@
                 }
             }
             splay(x, nullptr);
-            if (!cmp(*x->key, key) && !cmp(key, *x->key)) return std::make_pair(iterator(x, this), false);
-            else if (cmp(key, *x->key)) {
-                z = new Node(new Key(std::move(key)));
+            int c = order(key, x->key);
+            if (c == 0) return std::make_pair(iterator(x, this), false);
+            else if (c < 0) {
+                z = newNode(std::forward<K>(key));
                 x->link(0, z);
                 updateToRoot(z);
                 splay(z, nullptr);
                 return std::make_pair(iterator(z, this), true);
             } else {
-                y = findNext(x), z = new Node(new Key(std::move(key)));
+                y = findNext(x), z = newNode(std::forward<K>(key));
                 if (y) {
                     splay(y, x);
                     y->link(0, z);
@@ -284,24 +415,41 @@
             return std::make_pair(iterator(nullptr, this), false);
         }
 
+        template <class... Args>
+        std::pair<iterator, bool> emplaceKey(std::false_type, Args&&... args) {
+            return emplaceKey(std::true_type(), Key(std::forward<Args>(args)...));
+        }
+
+    public:
+        // The Key is only made once it is known to be new, if the argument can be looked up as is.
+        template<class... Args>
+        std::pair<iterator, bool> emplace(Args&&... args) {
+            return emplaceKey(ESetEmplaceLookup<Compare, Key, Args...>(), std::forward<Args>(args)...);
+        }
+
         size_t erase(const Key &key) {
+            return erase<Key>(key);
+        }
+
+        template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+        size_t erase(const K &key) {
             Node *p = nfind(key);
             if (!p) return 0;
             splay(p, nullptr);
             if (!p->s[0]) {
                 root = p->s[1];
                 if (p->s[1]) p->s[1]->fa = nullptr;
-                delete p;
+                freeNode(p);
             } else if (!p->s[1]) {
                 root = p->s[0];
                 p->s[0]->fa = nullptr;
-                delete p;
+                freeNode(p);
             } else {
                 Node *x = findPrev(p), *y = findNext(p);
                 splay(x, nullptr);
                 splay(y, x);
                 y->s[0] = nullptr;
-                delete p;
+                freeNode(p);
                 updateToRoot(y);
             }
             return 1;
@@ -322,34 +470,103 @@
         }
 
         size_t range(const Key &l, const Key &r) const {
-            if (root == nullptr) return 0;
-            Node *x = nlower_bound(l);
-            if (!x) return 0;
-            splay(x, nullptr);
-            Node *y = nupper_bound(r);
-            if (y==x) return 0;
-            if (!y) return getSize(x->s[1])+1;
-            splay(y, x);
-            return getSize(y->s[0])+1;
+            return range<Key>(l, r);
+        }
+
+        /*
+        Descends together until the paths to l and r part, then follows each,
+        and splays the deepest node visited so that the descent is paid for.
+        */
+        template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+        size_t range(const K &l, const K &r) const {
+            if (!root || cmp(r, l)) return 0;
+            Node *x = root, *last = root;
+            int depth = 0, deepest = 0;
+            ESET_COUNT(descents);
+            for (; x; depth++) {
+                ESET_COUNT(visits);
+                last = x;
+                if (cmp(x->key, l)) {
+                    x = x->s[1];
+                } else if (cmp(r, x->key)) {
+                    x = x->s[0];
+                } else break;
+            }
+            size_t cnt = 0;
+            if (x) {
+                cnt = 1;
+                deepest = depth;
+                int d = depth + 1;
+                for (Node *y = x->s[0]; y; d++) {
+                    ESET_COUNT(visits);
+                    if (d >= deepest) deepest = d, last = y;
+                    if (!cmp(y->key, l)) {
+                        cnt += getSize(y->s[1]) + 1;
+                        y = y->s[0];
+                    } else y = y->s[1];
+                }
+                d = depth + 1;
+                for (Node *y = x->s[1]; y; d++) {
+                    ESET_COUNT(visits);
+                    if (d >= deepest) deepest = d, last = y;
+                    if (!cmp(r, y->key)) {
+                        cnt += getSize(y->s[0]) + 1;
+                        y = y->s[1];
+                    } else y = y->s[0];
+                }
+            }
+            splay(last, nullptr);
+            return cnt;
+        }
+
+        // The k-th smallest key, counting from 0, or end() if k >= size().
+        iterator nth(size_t k) const {
+            return iterator(findNth(k), this);
+        }
+
+        // Number of keys less than key.
+        size_t rank(const Key &key) const {
+            return rank<Key>(key);
+        }
+
+        template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+        size_t rank(const K &key) const {
+            Node *x = nlower_bound(key);
+            return x ? position(x) : getSize(root);
         }
 
         iterator find(const Key &key) const {
             return iterator(nfind(key), this);
         }
 
+        template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+        iterator find(const K &key) const {
+            return iterator(nfind(key), this);
+        }
+
         iterator lower_bound(const Key &key) const {
             return iterator(nlower_bound(key), this);
         }
 
+        template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+        iterator lower_bound(const K &key) const {
+            return iterator(nlower_bound(key), this);
+        }
+
         iterator upper_bound(const Key &key) const {
             return iterator(nupper_bound(key), this);
         }
 
+        template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+        iterator upper_bound(const K &key) const {
+            return iterator(nupper_bound(key), this);
+        }
+
 
     #ifdef DEBUG
         void debug_print(Node *ptr, int x) const {
             if (!ptr) return;
-            std::cerr << x << ": " <<  "size: " << ptr->size << ", key: " << *ptr->key << "\n";
+            std::cerr << x << ": " <<  "size: " << ptr->size << ", key: " << ptr->key << "\n";
             debug_print(ptr->s[0], x*2);
             debug_print(ptr->s[1], x*2+1);
         }
@@ -359,6 +576,12 @@
         }
     #endif
     };
-// }
+} // namespace eset::splay
 
-#endif
\ No newline at end of file
+#if !defined(ESET_NO_GLOBAL) && !defined(ESET_GLOBAL_DEFINED)
+#define ESET_GLOBAL_DEFINED
+template <typename Key, typename Compare = std::less<Key>>
+using ESet = eset::splay::ESet<Key, Compare>;
+#endif
+
+#endif
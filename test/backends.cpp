@@ -0,0 +1,281 @@
+#include "../eset.hpp"
+#include <set>
+#include <iostream>
+#include <random>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <vector>
+#include <string>
+#include <string_view>
+
+// The backends with no test1.cpp of their own, each through its policy.
+
+const int M = 50;
+
+// Key x of 0..M: a third from the bottom of K's range, a third around zero and a third from the top
+template <class K>
+K edge(int x) {
+    if (x < M/3) return std::numeric_limits<K>::min() + K(x);
+    if (x > 2*M/3) return std::numeric_limits<K>::max() - K(M - x);
+    return K(x - M/2);
+}
+
+// Whether s holds exactly the keys of t, in order
+template <class S, class T>
+bool same(const S &s, const T &t) {
+    if (s.size() != t.size()) return false;
+    auto x = s.begin();
+    auto y = t.begin();
+    for (; x!=s.end() && y!=t.end(); ++x, ++y) {
+        if (*x != *y) return false;
+    }
+    return x == s.end() && y == t.end();
+}
+
+// Randomly insert and erase the keys mk(0..M), checking nth, rank and iterator moves against T
+template <class S, class T, class Mk>
+void orderCheck(Mk mk) {
+    S s1;
+    T s2;
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> dist(0, M);
+    std::bernoulli_distribution dist2(0.5);
+    for (int i=0; i<20000; i++) {
+        auto x = mk(dist(rng));
+        if (dist2(rng)) {
+            if (s1.emplace(x).second != s2.emplace(x).second) {
+                std::cout << "error" << std::endl;
+            }
+        } else {
+            if (s1.erase(x) != s2.erase(x)) {
+                std::cout << "error" << std::endl;
+            }
+        }
+        if (!same(s1, s2)) {
+            std::cout << "error" << std::endl;
+        }
+        std::vector<typename T::value_type> v(s2.begin(), s2.end());
+        int n = v.size();
+
+        for (int k=0; k<=n+1; k++) {
+            auto it = s1.nth(k);
+            if (k >= n ? it != s1.end() : *it != v[k]) {
+                std::cout << "error" << std::endl;
+            }
+        }
+        for (int j=0; j<=M; j++) {
+            auto key = mk(j);
+            if (s1.rank(key) != size_t(std::distance(s2.begin(), s2.lower_bound(key)))) {
+                std::cout << "error" << std::endl;
+            }
+        }
+
+        // Moves stop at begin() and end()
+        int k = std::uniform_int_distribution<int>(0, n)(rng);
+        int d = std::uniform_int_distribution<int>(-n-2, n+2)(rng);
+        auto it = s1.nth(k), it2 = it;
+        it += d;
+        it2 -= d;
+        if (it != s1.nth(std::min(std::max(k+d, 0), n)) || it2 != s1.nth(std::min(std::max(k-d, 0), n))) {
+            std::cout << "error" << std::endl;
+        }
+        if (s1.nth(k) + d != it || s1.nth(k) - d != it2) {
+            std::cout << "error" << std::endl;
+        }
+        if (n) {
+            auto b = s1.begin(), e = s1.end();
+            --b;
+            ++e;
+            if (b != s1.begin() || e != s1.end() || *--e != v[n-1]) {
+                std::cout << "error" << std::endl;
+            }
+        }
+    }
+}
+
+// String x of 0..M over NUL, 'a' and 'b': short ones that begin longer ones, and long ones that
+// share more of a prefix than a radix tree node keeps inline
+std::string word(int x) {
+    std::string s = x % 2 ? std::string(12, 'a') : "";
+    for (x /= 2; x; x /= 3) s += "\0ab"[x % 3];
+    return s;
+}
+
+// The keys word(0..M), looked up by std::string_view under std::less<>
+template <class S>
+void viewCheck() {
+    S s1;
+    std::set<std::string> s2;
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> dist(0, M);
+    std::bernoulli_distribution dist2(0.5);
+    for (int i=0; i<20000; i++) {
+        std::string k = word(dist(rng)), l = word(dist(rng));
+        std::string_view v = k, w = l;
+        if (dist2(rng)) {
+            if (s1.emplace(v).second != s2.emplace(k).second) {
+                std::cout << "error" << std::endl;
+            }
+        } else {
+            if (s1.erase(v) != s2.erase(k)) {
+                std::cout << "error" << std::endl;
+            }
+        }
+
+        auto it = s1.find(v);
+        if ((it == s1.end()) != (s2.find(k) == s2.end()) || (it != s1.end() && *it != k)) {
+            std::cout << "error" << std::endl;
+        }
+        auto lb = s1.lower_bound(v), ub = s1.upper_bound(v);
+        auto lb2 = s2.lower_bound(k), ub2 = s2.upper_bound(k);
+        if ((lb == s1.end() ? lb2 != s2.end() : *lb != *lb2) || (ub == s1.end() ? ub2 != s2.end() : *ub != *ub2)) {
+            std::cout << "error" << std::endl;
+        }
+        if (s1.rank(v) != size_t(std::distance(s2.begin(), lb2)) || s1.range(w, v) != (k < l ? 0 : size_t(std::distance(s2.lower_bound(l), ub2)))) {
+            std::cout << "error" << std::endl;
+        }
+    }
+}
+
+// A string key that counts how many times one is constructed
+struct Name {
+    static int made;
+    std::string s;
+
+    Name(std::string_view v) : s(v) { made++; }
+    Name(const Name &other) : s(other.s) { made++; }
+    Name(Name &&other) : s(std::move(other.s)) { made++; }
+    Name& operator=(const Name &other) = default;
+    Name& operator=(Name &&other) = default;
+};
+
+int Name::made = 0;
+
+bool operator<(const Name &a, const Name &b) { return a.s < b.s; }
+bool operator<(const Name &a, std::string_view b) { return a.s < b; }
+bool operator<(std::string_view a, const Name &b) { return a < b.s; }
+
+// Lookups by std::string_view under std::less<>, and emplace of a key that is already there
+template <class S>
+void lookupCheck() {
+    S s1;
+    std::set<std::string> s2;
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> dist(0, 30);
+    std::bernoulli_distribution dist2(0.5);
+    for (int i=0; i<20000; i++) {
+        std::string k = std::to_string(dist(rng));
+        std::string_view v = k;
+        if (dist2(rng)) {
+            int made = Name::made;
+            bool fresh = s1.emplace(v).second;
+            if (fresh != s2.emplace(k).second || (!fresh && Name::made != made)) {
+                std::cout << "error" << std::endl;
+            }
+        } else {
+            int made = Name::made;
+            if (s1.erase(v) != s2.erase(k) || Name::made != made) {
+                std::cout << "error" << std::endl;
+            }
+        }
+
+        int made = Name::made;
+        auto it = s1.find(v);
+        if ((it == s1.end()) != (s2.find(k) == s2.end()) || (it != s1.end() && it->s != k)) {
+            std::cout << "error" << std::endl;
+        }
+        auto lb = s1.lower_bound(v), ub = s1.upper_bound(v);
+        auto lb2 = s2.lower_bound(k), ub2 = s2.upper_bound(k);
+        if ((lb == s1.end() ? lb2 != s2.end() : lb->s != *lb2) || (ub == s1.end() ? ub2 != s2.end() : ub->s != *ub2)) {
+            std::cout << "error" << std::endl;
+        }
+        if (s1.rank(v) != size_t(std::distance(s2.begin(), lb2)) || s1.range(std::string_view("1"), v) != (k < "1" ? 0 : size_t(std::distance(s2.lower_bound("1"), ub2)))) {
+            std::cout << "error" << std::endl;
+        }
+        if (Name::made != made) {
+            std::cout << "error" << std::endl;
+        }
+    }
+}
+
+// B+ tree: int keys take the vectorized count loop, long long keys (without
+// -msse4.2), std::greater and a class key the binary search
+void test1() {
+    std::cout << "test1:" << std::endl;
+    orderCheck<eset::ESet<int, std::less<int>, eset::BPlus>, std::set<int>>(edge<int>);
+    orderCheck<eset::ESet<long long, std::less<long long>, eset::BPlus>, std::set<long long>>(edge<long long>);
+    orderCheck<eset::ESet<int, std::greater<int>, eset::BPlus>, std::set<int, std::greater<int>>>(edge<int>);
+    lookupCheck<eset::ESet<Name, std::less<>, eset::BPlus>>();
+}
+
+// Skip list
+void test2() {
+    std::cout << "test2:" << std::endl;
+    orderCheck<eset::ESet<int, std::less<int>, eset::SkipList>, std::set<int>>(edge<int>);
+    orderCheck<eset::ESet<long long, std::greater<long long>, eset::SkipList>, std::set<long long, std::greater<long long>>>(edge<long long>);
+    lookupCheck<eset::ESet<Name, std::less<>, eset::SkipList>>();
+}
+
+// AVL tree
+void test3() {
+    std::cout << "test3:" << std::endl;
+    orderCheck<eset::ESet<int, std::less<int>, eset::AVL>, std::set<int>>(edge<int>);
+    orderCheck<eset::ESet<long long, std::greater<long long>, eset::AVL>, std::set<long long, std::greater<long long>>>(edge<long long>);
+    lookupCheck<eset::ESet<Name, std::less<>, eset::AVL>>();
+}
+
+// Integer trie, with keys at both ends of the range and where the sign bit flips
+void test4() {
+    std::cout << "test4:" << std::endl;
+    typedef eset::ESet<long long, std::less<long long>, eset::IntegerTrie> S;
+    orderCheck<eset::ESet<int, std::less<int>, eset::IntegerTrie>, std::set<int>>(edge<int>);
+    orderCheck<S, std::set<long long>>(edge<long long>);
+    orderCheck<eset::ESet<unsigned long long, std::less<unsigned long long>, eset::IntegerTrie>, std::set<unsigned long long>>(edge<unsigned long long>);
+    static_assert(!std::is_assignable<decltype(*S().begin()), long long>::value, "*it must not be assignable");
+
+    // Erase the key under an iterator, then step from it
+    S s1;
+    std::set<long long> s2;
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> dist(0, M);
+    for (int i=0; i<20000; i++) {
+        long long x = edge<long long>(dist(rng));
+        s1.emplace(x);
+        s2.emplace(x);
+        auto it = s1.find(edge<long long>(dist(rng)));
+        if (it == s1.end()) continue;
+        long long key = *it;
+        s1.erase(key);
+        s2.erase(key);
+        auto up = s2.upper_bound(key), low = s2.lower_bound(key);
+        auto it2 = it;
+        ++it;
+        --it2;
+        if (up == s2.end() ? it != s1.end() : *it != *up) {
+            std::cout << "error" << std::endl;
+        }
+        if (low != s2.begin() && *it2 != *--low) {
+            std::cout << "error" << std::endl;
+        }
+    }
+}
+
+// Adaptive radix tree, on integers and on strings with embedded NULs
+void test5() {
+    std::cout << "test5:" << std::endl;
+    orderCheck<eset::ESet<int, std::less<int>, eset::ART>, std::set<int>>(edge<int>);
+    orderCheck<eset::ESet<long long, std::less<>, eset::ART>, std::set<long long>>(edge<long long>);
+    orderCheck<eset::ESet<std::string, std::less<std::string>, eset::ART>, std::set<std::string>>(word);
+    orderCheck<eset::ESet<std::string, std::less<>, eset::ART>, std::set<std::string>>(word);
+    viewCheck<eset::ESet<std::string, std::less<>, eset::ART>>();
+}
+
+int main() {
+    test1();
+    test2();
+    test3();
+    test4();
+    test5();
+    return 0;
+}
@@ -1,63 +1,212 @@
-#ifndef ESET_HPP
-#define ESET_HPP
+#ifndef ESET_TREAP_HPP
+#define ESET_TREAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#if __cplusplus > 201703L
+#include <compare>
+#endif
 
 #ifdef DEBUG
 #include <iostream>
 #endif
 
-#include <stdexcept>
-#include <random>
-#include <vector>
+#include "../common/eset_common.hpp"
+
+namespace eset::treap {
 
 template <typename Key, typename Compare = std::less<Key>>
 class ESet {
 private:
+    /*
+    A key together with the number of nodes pointing to it. Path copies of a
+    node share its key, which is freed with the last of them.
+    */
+    struct Item {
+        Key key;
+        size_t ref;
+
+        template <class K>
+        explicit Item(K &&key) : key(std::forward<K>(key)), ref(0) {}
+    };
+
+    /*
+    Nodes are addressed by 32-bit indices into the pool, 0 standing for the
+    empty tree. Their fields are split in two arrays: what a search reads
+    (key and children, 16 bytes) and what only updates read (size, rank and
+    reference count), so that descents touch half as many cache lines.
+    */
+    typedef std::uint32_t Index;
+
     struct Node {
-        const Key *key;
-        size_t s[2], rank, size;
+        Item *item;
+        Index s[2];
 
-        Node(const Key *key, size_t rank) : key(key), s{0, 0}, rank(rank), size(0) {}
+        Node() {}
+        Node(Item *item) : item(item), s{0, 0} {}
+    };
 
-        void link(size_t x, size_t d) {
-            s[d] = x;
-        }
+    struct Meta {
+        Index size, rank;
+        // Links to this node from other nodes and from roots of ESets.
+        Index ref;
+
+        Meta() {}
+        Meta(Index rank) : size(0), rank(rank), ref(0) {}
     };
 
+    /*
+    Nodes shared by all the copies of an ESet. Every index returned by
+    generateNew, copy and merge carries one reference, which is either stored
+    as a link or given back with release. Unreachable nodes go to a free list,
+    chained through s[0], and are reused before the pool grows.
+
+    Both arrays are kept in fixed-size chunks, so growing the pool never moves
+    a node: references returned by get and info stay valid, and growth costs
+    one chunk allocation instead of copying the whole pool.
+    */
     class MemoryPool {
     private:
-        std::vector<Node> pool;
-        std::vector<const Key*> value;
+        static constexpr int CHUNK_BITS = 12;
+        static constexpr Index CHUNK = Index(1) << CHUNK_BITS;
+
+        std::vector<Node*> pool;
+        std::vector<Meta*> meta;
+        Index used;
+        Index free_list;
         size_t ref_count;
-        std::mt19937_64 gen;
+        std::mt19937 gen;
+
+        Index allocate(const Node &n, const Meta &m) {
+            Index x = free_list;
+            if (x) {
+                free_list = get(x).s[0];
+            } else {
+                if (used == pool.size() * CHUNK) {
+                    pool.push_back(new Node[CHUNK]);
+                    meta.push_back(new Meta[CHUNK]);
+                }
+                x = used++;
+            }
+            get(x) = n;
+            info(x) = m;
+            return x;
+        }
 
     public:
-        MemoryPool() : ref_count(1), gen(), pool{Node(nullptr, 0)} {}
+        MemoryPool() : used(0), free_list(0), ref_count(1), gen() {
+            allocate(Node(nullptr), Meta(0));
+        }
+
+        MemoryPool(const MemoryPool&) = delete;
+        MemoryPool& operator=(const MemoryPool&) = delete;
+
+        ~MemoryPool() {
+            for (Node *c : pool) delete[] c;
+            for (Meta *c : meta) delete[] c;
+        }
+
+        Index rank() {
+            return gen();
+        }
 
-        size_t generateNew(const Key *key) {
-            value.emplace_back(key);
-            pool.emplace_back(key, gen());
-            pool.back().size = 1;
-            return pool.size()-1;
+        template <class K>
+        Index generateNew(K &&key, Index rank) {
+            Item *item = new Item(std::forward<K>(key));
+            item->ref = 1;
+            Index x = allocate(Node(item), Meta(rank));
+            info(x).size = info(x).ref = 1;
+            return x;
+        }
+
+        Index copy(Index other) {
+            ESET_COUNT(copies);
+            Index x = allocate(Node(get(other)), Meta(info(other)));
+            Node &n = get(x);
+            info(x).ref = 1;
+            n.item->ref++;
+            if (n.s[0]) info(n.s[0]).ref++;
+            if (n.s[1]) info(n.s[1]).ref++;
+            return x;
+        }
+
+        // Trade a reference to x for one to a node that nobody else sees.
+        Index own(Index x) {
+            if (info(x).ref == 1) return x;
+            Index y = copy(x);
+            release(x);
+            return y;
         }
 
-        size_t copy(size_t other) {
-            pool.emplace_back(pool[other]);
-            return pool.size()-1;
+        Node& get(Index index) {
+            return pool[index >> CHUNK_BITS][index & (CHUNK - 1)];
         }
 
-        Node& get(size_t index) {
-            return pool[index];
+        Meta& info(Index index) {
+            return meta[index >> CHUNK_BITS][index & (CHUNK - 1)];
         }
 
-        void update(size_t index) {
-            pool[index].size = pool[pool[index].s[0]].size + pool[pool[index].s[1]].size + 1;
+        void update(Index index) {
+            info(index).size = info(get(index).s[0]).size + info(get(index).s[1]).size + 1;
         }
 
-        void link(size_t x, size_t y, size_t d) {
-            pool[x].link(y, d);
+        // Replace the d-th child of x by y, taking over the reference to y.
+        void link(Index x, Index y, int d) {
+            release(get(x).s[d]);
+            get(x).s[d] = y;
             update(x);
         }
 
+        Index acquire(Index x) {
+            if (x) info(x).ref++;
+            return x;
+        }
+
+        // Give back one reference to x and free whatever becomes unreachable.
+        void release(Index x) {
+            if (!x || --info(x).ref) return;
+            std::vector<Index> stack(1, x);
+            while (!stack.empty()) {
+                x = stack.back();
+                stack.pop_back();
+                for (Index c : get(x).s) {
+                    if (c && !--info(c).ref) stack.push_back(c);
+                }
+                dispose(x);
+            }
+        }
+
+        // Free the unreferenced node x alone, whose links were taken over.
+        void dispose(Index x) {
+            Node &n = get(x);
+            if (!--n.item->ref) delete n.item;
+            n.item = nullptr;
+            n.s[0] = free_list;
+            free_list = x;
+        }
+
+        // Copy the tree x of another pool into this one, sharing the keys.
+        Index import(MemoryPool &from, Index x) {
+            if (!x) return 0;
+            const Node &n = from.get(x);
+            Index l = import(from, n.s[0]), r = import(from, n.s[1]);
+            ESET_COUNT(copies);
+            n.item->ref++;
+            Index y = allocate(Node(n.item), Meta(from.info(x).rank));
+            get(y).s[0] = l;
+            get(y).s[1] = r;
+            info(y).ref = 1;
+            update(y);
+            return y;
+        }
+
         MemoryPool* assign() {
             ref_count++;
             return this;
@@ -68,94 +217,336 @@ private:
             return !ref_count;
         }
 
-        ~MemoryPool() {
-            for (auto &i : value) {
-                delete i;
-            }
-        }
-
 #ifdef DEBUG
-        void debug_print() const {
-            for (size_t i = 1; i < pool.size(); i++) {
-                std::cerr << i << ": " << *pool[i].key << " " << pool[i].s[0] << " " << pool[i].s[1] << " " << pool[i].rank << " " << pool[i].size << std::endl;
+        void debug_print() {
+            for (Index i = 1; i < used; i++) {
+                if (!get(i).item) continue;
+                std::cerr << i << ": " << get(i).item->key << " " << get(i).s[0] << " " << get(i).s[1] << " " << info(i).rank << " " << info(i).size << " " << info(i).ref << std::endl;
             }
             std::cerr << std::endl;
         }
 #endif
     };
 
-    mutable size_t root;
+    mutable Index root;
     mutable MemoryPool *p;
-    Compare cmp;
-
-    std::pair<size_t, size_t> splitBelow(size_t r, const Key &key) {
-        if (!r) return std::make_pair(0, 0);
-        Node n = p->get(r);
-        size_t x, y;
-        if (cmp(*n.key, key)) {
-            x = p->copy(r);
-            auto pair = splitBelow(n.s[1], key);
-            p->link(x, pair.first, 1);
-            y = pair.second;
-        } else {
-            y = p->copy(r);
-            auto pair = splitBelow(n.s[0], key);
-            p->link(y, pair.second, 0);
-            x = pair.first;
-        }
-        return std::make_pair(x, y);
-    }
-
-    std::pair<size_t, size_t> splitAbove(size_t r, const Key &key) {
-        if (!r) return std::make_pair(0, 0);
-        Node n = p->get(r);
-        size_t x, y;
-        if (cmp(key, *n.key)) {
-            y = p->copy(r);
-            auto pair = splitAbove(n.s[0], key);
-            p->link(y, pair.second, 0);
-            x = pair.first;
+    // Bumped whenever the tree changes, which invalidates cached iterator paths.
+    size_t version;
+    ESET_COMPARE(Compare) cmp;
+
+    // cmp as a three-way comparison, see ESetOrder.
+    int order(const Key &a, const Key &b) const {
+        return ESetOrder<Compare, Key>::compare(cmp, a, b);
+    }
+
+    // Other key types go through the transparent comparator, twice.
+    template <class A, class B>
+    int order(const A &a, const B &b) const {
+        if (cmp(a, b)) return -1;
+        return cmp(b, a);
+    }
+
+    /*
+    Whether x, the child of an owned node (or the root, for owned = true),
+    belongs to this set alone: then no other version can see it and it is
+    modified in place instead of being copied. The functions below take
+    this flag along with their subtree r. An owned r is handed over to them,
+    and its link is reused for their result; otherwise r is only read, and
+    the nodes they change are copies.
+    */
+    bool owns(Index x, bool owned) const {
+        return owned && x && p->info(x).ref == 1;
+    }
+
+    /*
+    Make c the d-th child of r, or of a copy of r if r is not owned. moved
+    tells whether the old child was owned too, and so handed over to make c.
+    */
+    Index relink(Index r, bool owned, bool moved, int d, Index c) {
+        if (!owned) r = p->copy(r);
+        if (moved) {
+            p->get(r).s[d] = c;
+            p->update(r);
+        } else p->link(r, c, d);
+        return r;
+    }
+
+    /*
+    Split r into the keys below and above key.
+    le is the last node on the search path so far whose key is not above key.
+    If key turns out to be in r, hit is set to its node and nothing is changed.
+    */
+    template <class K>
+    std::pair<Index, Index> splitFresh(Index r, bool owned, const K &key, Index le, Index &hit) {
+        if (!r) {
+            if (le && !cmp(p->get(le).item->key, key)) hit = le;
+            return std::make_pair(0, 0);
+        }
+        ESET_COUNT(visits);
+        const Node &n = p->get(r);
+        if (cmp(key, n.item->key)) {
+            bool moved = owns(n.s[0], owned);
+            auto pair = splitFresh(n.s[0], moved, key, le, hit);
+            if (hit) return pair;
+            return std::make_pair(pair.first, relink(r, owned, moved, 0, pair.second));
         } else {
-            x = p->copy(r);
-            auto pair = splitAbove(n.s[1], key);
-            p->link(x, pair.first, 1);
-            y = pair.second;
+            bool moved = owns(n.s[1], owned);
+            auto pair = splitFresh(n.s[1], moved, key, r, hit);
+            if (hit) return pair;
+            return std::make_pair(relink(r, owned, moved, 1, pair.first), pair.second);
+        }
+    }
+
+    /*
+    Insert key into r with the given rank, in one descent: down to where the
+    rank puts the new node, then splitting the rest of the path under it.
+    Returns the new subtree and sets hit to the new node, or returns 0 and
+    sets hit to the node of key if it was already there.
+    */
+    template <class K>
+    Index insert(Index r, bool owned, K &&key, Index rank, Index le, Index &hit) {
+        if (!r || p->info(r).rank < rank) {
+            auto pair = splitFresh(r, owned, key, le, hit);
+            if (hit) return 0;
+            Index y = hit = p->generateNew(std::forward<K>(key), rank);
+            p->link(y, pair.first, 0);
+            p->link(y, pair.second, 1);
+            return y;
         }
-        return std::make_pair(x, y);
+        ESET_COUNT(visits);
+        const Node &n = p->get(r);
+        int d = !cmp(key, n.item->key);
+        bool moved = owns(n.s[d], owned);
+        Index c = insert(n.s[d], moved, std::forward<K>(key), rank, d ? r : le, hit);
+        if (!c) return 0;
+        return relink(r, owned, moved, d, c);
     }
 
-    size_t merge(size_t x, size_t y) {
+    /*
+    Erase key from r: put the merge of the children of its node in its
+    place. Returns the new subtree, or 0 with found left false if key is
+    not in r.
+    */
+    template <class K>
+    Index erase(Index r, bool owned, const K &key, bool &found) {
+        if (!r) return 0;
+        ESET_COUNT(visits);
+        const Node &n = p->get(r);
+        int d = order(key, n.item->key);
+        if (!d) {
+            found = true;
+            if (!owned) return merge(p->acquire(n.s[0]), p->acquire(n.s[1]));
+            Index c = merge(n.s[0], n.s[1]);
+            p->dispose(r);
+            return c;
+        }
+        d = d > 0;
+        bool moved = owns(n.s[d], owned);
+        Index c = erase(n.s[d], moved, key, found);
+        if (!found) return 0;
+        return relink(r, owned, moved, d, c);
+    }
+
+    // Takes a reference to x and y and returns one to the result. Nodes
+    // shared with other versions are copied before they are modified.
+    Index merge(Index x, Index y) {
         if (!x) return y;
         if (!y) return x;
-        Node &u = p->get(x), &v = p->get(y);
-        if (u.rank >= v.rank) {
-            p->link(x, merge(u.s[1], y), 1);
+        if (p->info(x).rank >= p->info(y).rank) {
+            x = p->own(x);
+            Node &u = p->get(x);
+            u.s[1] = merge(u.s[1], y);
+            p->update(x);
             return x;
         } else {
-            p->link(y, merge(x, v.s[0]), 0);
+            y = p->own(y);
+            Node &v = p->get(y);
+            v.s[0] = merge(x, v.s[0]);
+            p->update(y);
             return y;
         }
-        return 0;
     }
 
-    size_t nfind(const Key &key) const {
-        size_t x;
+    /*
+    Split x, whose reference is taken, into the keys below and above key,
+    set into l and r, and return the node of key itself with its children
+    cut off, or 0.
+    */
+    Index split(Index x, const Key &key, Index &l, Index &r) {
+        if (!x) {
+            l = r = 0;
+            return 0;
+        }
+        ESET_COUNT(visits);
+        x = p->own(x);
+        Node &n = p->get(x);
+        Index m;
+        int c = order(key, n.item->key);
+        if (c < 0) {
+            m = split(n.s[0], key, l, n.s[0]);
+            r = x;
+        } else if (c > 0) {
+            m = split(n.s[1], key, n.s[1], r);
+            l = x;
+        } else {
+            l = n.s[0];
+            r = n.s[1];
+            n.s[0] = n.s[1] = 0;
+            m = x;
+        }
+        p->update(x);
+        return m;
+    }
+
+    /*
+    Split x, whose reference is taken, into the keys below key (or not
+    above it, if inclusive) and the rest.
+    */
+    void cut(Index x, const Key &key, bool inclusive, Index &l, Index &r) {
+        if (!x) {
+            l = r = 0;
+            return;
+        }
+        ESET_COUNT(visits);
+        x = p->own(x);
+        Node &n = p->get(x);
+        if (inclusive ? !cmp(key, n.item->key) : cmp(n.item->key, key)) {
+            cut(n.s[1], key, inclusive, n.s[1], r);
+            l = x;
+        } else {
+            cut(n.s[0], key, inclusive, l, n.s[0]);
+            r = x;
+        }
+        p->update(x);
+    }
+
+    /*
+    Set operations on two trees of this pool, whose references are taken.
+    The root with the higher rank stays on top and the other tree is split
+    by its key, so subtrees that one side leaves alone are shared as they
+    are and the work is O(m log(n/m + 1)) for sizes m <= n. `theirs` tells
+    that x came from the other set: when a key is in both, the item of ours
+    is kept, so that iterators to it stay valid.
+    */
+    Index unite(Index x, Index y, bool theirs) {
+        if (!x) return y;
+        if (!y) return x;
+        if (p->info(x).rank < p->info(y).rank) {
+            std::swap(x, y);
+            theirs = !theirs;
+        }
+        x = p->own(x);
+        Node &n = p->get(x);
+        Index l, r, m = split(y, n.item->key, l, r);
+        if (m && theirs) std::swap(n.item, p->get(m).item);
+        p->release(m);
+        n.s[0] = unite(n.s[0], l, theirs);
+        n.s[1] = unite(n.s[1], r, theirs);
+        p->update(x);
+        return x;
+    }
+
+    Index intersect(Index x, Index y, bool theirs) {
+        if (!x || !y) {
+            p->release(x);
+            p->release(y);
+            return 0;
+        }
+        if (p->info(x).rank < p->info(y).rank) {
+            std::swap(x, y);
+            theirs = !theirs;
+        }
+        x = p->own(x);
+        Node &n = p->get(x);
+        Index l, r, m = split(y, n.item->key, l, r);
+        if (m && theirs) std::swap(n.item, p->get(m).item);
+        Index a = intersect(n.s[0], l, theirs), b = intersect(n.s[1], r, theirs);
+        if (!m) {
+            p->dispose(x);
+            return merge(a, b);
+        }
+        p->release(m);
+        n.s[0] = a;
+        n.s[1] = b;
+        p->update(x);
+        return x;
+    }
+
+    // The keys of x that are not in y.
+    Index subtract(Index x, Index y) {
+        if (!x || !y) {
+            p->release(y);
+            return x;
+        }
+        Index l, r, m;
+        if (p->info(x).rank >= p->info(y).rank) {
+            x = p->own(x);
+            Node &n = p->get(x);
+            m = split(y, n.item->key, l, r);
+            p->release(m);
+            Index a = subtract(n.s[0], l), b = subtract(n.s[1], r);
+            if (m) {
+                p->dispose(x);
+                return merge(a, b);
+            }
+            n.s[0] = a;
+            n.s[1] = b;
+            p->update(x);
+            return x;
+        }
+        // Only the key and children of y are needed, so it is not copied.
+        const Node &n = p->get(y);
+        m = split(x, n.item->key, l, r);
+        p->release(m);
+        Index yl = p->acquire(n.s[0]), yr = p->acquire(n.s[1]);
+        p->release(y);
+        return merge(subtract(l, yl), subtract(r, yr));
+    }
+
+    Index symmetricSubtract(Index x, Index y) {
+        if (!x) return y;
+        if (!y) return x;
+        if (p->info(x).rank < p->info(y).rank) std::swap(x, y);
+        x = p->own(x);
+        Node &n = p->get(x);
+        Index l, r, m = split(y, n.item->key, l, r);
+        Index a = symmetricSubtract(n.s[0], l), b = symmetricSubtract(n.s[1], r);
+        if (m) {
+            p->release(m);
+            p->dispose(x);
+            return merge(a, b);
+        }
+        n.s[0] = a;
+        n.s[1] = b;
+        p->update(x);
+        return x;
+    }
+
+    template <class K>
+    Index nfind(const K &key) const {
+        Index x;
+        ESET_COUNT(descents);
         for (x=root; x;) {
+            ESET_COUNT(visits);
             Node &n = p->get(x);
-            if (cmp(*n.key, key)) {
+            int c = order(n.item->key, key);
+            if (c < 0) {
                 x = n.s[1];
-            } else if (cmp(key, *n.key)) {
+            } else if (c > 0) {
                 x = n.s[0];
             } else return x;
         }
         return 0;
     }
 
-    size_t findAbove(const Key &key) const {
-        size_t y = 0;
-        for (size_t x = root; x; ) {
+    template <class K>
+    Index findAbove(const K &key) const {
+        Index y = 0;
+        ESET_COUNT(descents);
+        for (Index x = root; x; ) {
+            ESET_COUNT(visits);
             const Node &n = p->get(x);
-            if (cmp(key, *n.key)) {
+            if (cmp(key, n.item->key)) {
                 y = x;
                 x = n.s[0];
             } else x = n.s[1];
@@ -163,11 +554,14 @@ private:
         return y;
     }
 
-    size_t findBelow(const Key &key) const {
-        size_t y = 0;
-        for (size_t x = root; x; ) {
+    template <class K>
+    Index findBelow(const K &key) const {
+        Index y = 0;
+        ESET_COUNT(descents);
+        for (Index x = root; x; ) {
+            ESET_COUNT(visits);
             const Node &n = p->get(x);
-            if (cmp(*n.key, key)) {
+            if (cmp(n.item->key, key)) {
                 y = x;
                 x = n.s[1];
             } else x = n.s[0];
@@ -175,32 +569,71 @@ private:
         return y;
     }
 
-    size_t findFirst() const {
-        size_t x, y;
-        for (x=root; x && (y=p->get(x).s[0]); x = y);
+    // The first (d = 0) or last node of the tree x.
+    Index findEnd(Index x, int d) const {
+        for (Index y; x && (y=p->get(x).s[d]); x = y);
         return x;
     }
 
-    size_t findLast() const {
-        size_t x, y;
-        for (x=root; x && (y=p->get(x).s[1]); x = y);
-        return x;
+    Index findFirst() const {
+        return findEnd(root, 0);
+    }
+
+    Index findLast() const {
+        return findEnd(root, 1);
+    }
+
+    // The k-th smallest node, counting from 0, or 0 if there are not that many.
+    Index findNth(size_t k) const {
+        ESET_COUNT(descents);
+        for (Index x = root; x; ) {
+            ESET_COUNT(visits);
+            const Node &n = p->get(x);
+            size_t l = p->info(n.s[0]).size;
+            if (k < l) {
+                x = n.s[0];
+            } else if (k > l) {
+                k -= l + 1;
+                x = n.s[1];
+            } else return x;
+        }
+        return 0;
     }
 
     /*
-    Sum the number of elements in the set that are no more than key.
-    [k <= key]
+    Sum the number of elements in [l, r] in one descent: down to the first
+    node inside the range, then along the paths to l and r below it.
     */
-    size_t count_lower(const Key &key) const {
-        size_t cnt=0, x;
-        for (x=root; x; ) {
-            Node &n = p->get(x);
-            if (!cmp(key, *n.key)) {
-                cnt += p->get(n.s[0]).size + 1;
+    template <class K>
+    size_t count_between(const K &l, const K &r) const {
+        Index x = root;
+        ESET_COUNT(descents);
+        for (; x; ) {
+            ESET_COUNT(visits);
+            const Node &n = p->get(x);
+            if (cmp(n.item->key, l)) {
                 x = n.s[1];
-            } else {
+            } else if (cmp(r, n.item->key)) {
                 x = n.s[0];
-            }
+            } else break;
+        }
+        if (!x) return 0;
+        size_t cnt = 1;
+        for (Index y = p->get(x).s[0]; y; ) {
+            ESET_COUNT(visits);
+            const Node &n = p->get(y);
+            if (!cmp(n.item->key, l)) {
+                cnt += p->info(n.s[1]).size + 1;
+                y = n.s[0];
+            } else y = n.s[1];
+        }
+        for (Index y = p->get(x).s[1]; y; ) {
+            ESET_COUNT(visits);
+            const Node &n = p->get(y);
+            if (!cmp(r, n.item->key)) {
+                cnt += p->info(n.s[0]).size + 1;
+                y = n.s[1];
+            } else y = n.s[0];
         }
         return cnt;
     }
@@ -209,12 +642,16 @@ private:
     Sum the number of elements in the set that are strictly less than key.
     [k < key]
     */
-    size_t count_upper(const Key &key) const {
-        size_t cnt=0, x;
+    template <class K>
+    size_t count_upper(const K &key) const {
+        size_t cnt=0;
+        Index x;
+        ESET_COUNT(descents);
         for (x=root; x; ) {
+            ESET_COUNT(visits);
             Node &n = p->get(x);
-            if (cmp(*n.key, key)) {
-                cnt += p->get(n.s[0]).size + 1;
+            if (cmp(n.item->key, key)) {
+                cnt += p->info(n.s[0]).size + 1;
                 x = n.s[1];
             } else {
                 x = n.s[0];
@@ -223,18 +660,106 @@ private:
         return cnt;
     }
 
+    // Let go of the tree and the pool.
+    void drop() {
+        if (!p) return;
+        p->release(root);
+        if (p->release()) delete p;
+    }
+
+    // A set made of the tree x of pool p, whose reference it takes.
+    ESet(MemoryPool *p, Index x): root(x), p(p->assign()), version(0) {}
+
+    /*
+    A reference to the tree of other in this pool. Sets that were copied
+    from each other share their pool; otherwise the smaller tree is copied
+    into the pool of the larger one, which this set moves to if needed.
+    */
+    Index share(const ESet &other) {
+        if (p != other.p) {
+            if (size() >= other.size()) return p->import(*other.p, other.root);
+            Index x = other.p->import(*p, root);
+            drop();
+            p = other.p->assign();
+            root = x;
+        }
+        return p->acquire(other.root);
+    }
+
     public:
 
+    /*
+    An iterator caches the path from the root down to its node, so stepping
+    costs amortized O(1). The path is only trusted while the set has not
+    changed since it was recorded (see version); otherwise it is found again
+    from the key, in O(log n). Paths deeper than MAX_DEPTH, which a treap
+    practically never has, are not cached.
+    */
     class iterator {
         friend class ESet;
     private:
+        static constexpr int MAX_DEPTH = 64;
+
         const Key *key;
         const ESet *from;
+        size_t version;
+        int depth;
+        Index path[MAX_DEPTH];
+
+        iterator(Index ptr, const ESet *from): key(ptr ? &from->p->get(ptr).item->key : nullptr), from(from), depth(0) {}
+
+        bool cached() const {
+            return depth && version == from->version;
+        }
+
+        // Record the path down to key, or to the last node for end().
+        bool locate() {
+            depth = 0;
+            version = from->version;
+            ESET_COUNT(descents);
+            for (Index x = from->root; x; ) {
+                if (depth == MAX_DEPTH) {
+                    depth = 0;
+                    return false;
+                }
+                ESET_COUNT(visits);
+                path[depth++] = x;
+                const Node &n = from->p->get(x);
+                int c = key ? from->order(n.item->key, *key) : -1;
+                if (c < 0) {
+                    x = n.s[1];
+                } else if (c > 0) {
+                    x = n.s[0];
+                } else break;
+            }
+            return true;
+        }
 
-        iterator(size_t ptr, const ESet *from): key(from->p->get(ptr).key), from(from) {}
+        // Move along the path to the next node (t = 1) or the previous one.
+        bool step(int t) {
+            if (Index c = from->p->get(path[depth-1]).s[t]) {
+                int d = depth;
+                for (; c; c = from->p->get(c).s[t^1]) {
+                    if (d == MAX_DEPTH) return false;
+                    path[d++] = c;
+                }
+                depth = d;
+            } else {
+                int d = depth - 1;
+                while (d && from->p->get(path[d-1]).s[t] == path[d]) d--;
+                if (!d) {
+                    // Past the last node is end(); before the first one, stay.
+                    if (t) key = nullptr, depth = 0;
+                    return true;
+                }
+                depth = d;
+            }
+            key = &from->p->get(path[depth-1]).item->key;
+            return true;
+        }
 
     public:
-        iterator(): key(0), from(nullptr) {}
+        iterator(): key(0), from(nullptr), depth(0) {}
 
         const Key& operator*() const {
             return *key;
@@ -245,18 +770,50 @@ private:
         }
 
         iterator& operator++() {
-            if (key) key = from->p->get(from->findAbove(*key)).key;
+            if (!key) return *this;
+            if ((cached() || locate()) && depth && step(1)) return *this;
+            *this = iterator(from->findAbove(*key), from);
             return *this;
         }
 
         iterator& operator--() {
-            const Key *tmp;
-            if (key) tmp = from->p->get(from->findBelow(*key)).key;
-            else tmp = from->p->get(from->findLast()).key;
-            if (tmp) key = tmp;
+            if (cached() || locate()) {
+                if (!depth) return *this;
+                if (!key) {
+                    key = &from->p->get(path[depth-1]).item->key;
+                    return *this;
+                }
+                if (step(0)) return *this;
+            }
+            Index tmp = key ? from->findBelow(*key) : from->findLast();
+            if (tmp) *this = iterator(tmp, from);
             return *this;
         }
 
+        // Moves k positions in O(log n), stopping at begin() or end().
+        iterator& operator+=(std::ptrdiff_t k) {
+            if (!from) return *this;
+            size_t i = key ? from->count_upper(*key) : from->size();
+            if (k < 0) i = size_t(-k) < i ? i + k : 0;
+            else i += k;
+            *this = iterator(from->findNth(i), from);
+            return *this;
+        }
+
+        iterator& operator-=(std::ptrdiff_t k) {
+            return *this += -k;
+        }
+
+        iterator operator+(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp += k;
+        }
+
+        iterator operator-(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp -= k;
+        }
+
         iterator operator++(int) {
             iterator tmp = *this;
             ++*this;
@@ -278,86 +835,220 @@ private:
         }
     };
 
-    ESet(): root(0), p(new MemoryPool()) {}
+    ESet(): root(0), p(new MemoryPool()), version(0) {}
 
-    ESet(const ESet& other) {
-        root = other.root;
+    ESet(const ESet& other) : version(0) {
+        root = other.p->acquire(other.root);
         p = other.p->assign();
     }
 
     ESet& operator=(const ESet& other) {
         if (&other == this) return *this;
-        if (p && p->release()) delete p;
+        other.p->acquire(other.root);
+        drop();
         root = other.root;
         p = other.p->assign();
+        version++;
         return *this;
     }
 
-    ESet(ESet&& other): root(other.root), p(other.p) {
+    ESet(ESet&& other): root(other.root), p(other.p), version(0) {
         other.p = nullptr;
     }
 
     ESet& operator=(ESet&& other) {
         if (&other == this) return *this;
-        if (p && p->release()) delete p;
+        drop();
         root = other.root;
         p = other.p;
         other.p = nullptr;
+        version++;
         return *this;
     }
 
     ~ESet() {
-        if (p && p->release()) delete p;
+        drop();
     }
 
-    template <typename... Args>
-    std::pair<iterator, bool> emplace(Args&&... args) {
-        Key key(std::forward<Args>(args)...);
-        if (!root) {
-            root = p->generateNew(new Key(std::move(key)));
-            return std::make_pair(iterator(root, this), true);
-        }
-
-        size_t x, y, z;
-        if (x = nfind(key)) return std::make_pair(iterator(x, this), false);
+private:
+    template <typename K>
+    std::pair<iterator, bool> emplaceKey(std::true_type, K &&key) {
+        Index hit = 0;
+        ESET_COUNT(descents);
+        bool owned = owns(root, true);
+        Index x = insert(root, owned, std::forward<K>(key), p->rank(), 0, hit);
+        if (!x) return std::make_pair(iterator(hit, this), false);
+        if (!owned) p->release(root);
+        root = x;
+        version++;
+        return std::make_pair(iterator(hit, this), true);
+    }
 
-        auto pair = splitAbove(root, key);
-        x = pair.first, z = pair.second;
-        y = p->generateNew(new Key(std::move(key)));
-        root = merge(merge(x, y), z);
+    template <typename... Args>
+    std::pair<iterator, bool> emplaceKey(std::false_type, Args&&... args) {
+        return emplaceKey(std::true_type(), Key(std::forward<Args>(args)...));
+    }
 
-        return std::make_pair(iterator(y, this), true);
+public:
+    // The Key is only made once it is known to be new, if the argument can be looked up as is.
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        return emplaceKey(ESetEmplaceLookup<Compare, Key, Args...>(), std::forward<Args>(args)...);
     }
 
     size_t erase(const Key& key) {
-        size_t x, y, z;
-        if (!(x = nfind(key))) return 0;
-
-        auto pair = splitBelow(root, key);
-        x = pair.first, y = pair.second;
-        pair = splitAbove(y, key);
-        y = pair.first, z = pair.second;
-        root = merge(x, z);
+        return erase<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t erase(const K &key) {
+        bool found = false;
+        ESET_COUNT(descents);
+        bool owned = owns(root, true);
+        Index x = erase(root, owned, key, found);
+        if (!found) return 0;
+        if (!owned) p->release(root);
+        root = x;
+        version++;
         return 1;
     }
 
     size_t size() const {
-        return p->get(root).size;
+        return p->info(root).size;
+    }
+
+    /*
+    Set algebra with another set, in O(m log(n/m + 1)) for sizes m <= n
+    (plus copying the smaller set when the two have no common ancestor).
+    The result shares what it can with other. Iterators to keys that stay
+    in this set stay valid.
+    */
+    void union_with(const ESet &other) {
+        if (&other == this) return;
+        Index y = share(other);
+        root = unite(root, y, false);
+        version++;
+    }
+
+    void intersect_with(const ESet &other) {
+        if (&other == this) return;
+        Index y = share(other);
+        root = intersect(root, y, false);
+        version++;
+    }
+
+    void difference_with(const ESet &other) {
+        Index y = &other == this ? p->acquire(root) : share(other);
+        root = subtract(root, y);
+        version++;
+    }
+
+    void symmetric_difference(const ESet &other) {
+        Index y = &other == this ? p->acquire(root) : share(other);
+        root = symmetricSubtract(root, y);
+        version++;
+    }
+
+    /*
+    Split and join in O(log n). The sets involved share nodes (and a pool)
+    afterwards, like copies do. Freeing the nodes that erase(l, r) drops
+    costs O(1) each on top, which is paid for by their insertion.
+    */
+
+    // Keep the keys below key and return the others as a set of their own.
+    ESet split(const Key &key) {
+        Index l, r;
+        cut(root, key, false, l, r);
+        root = l;
+        version++;
+        return ESet(p, r);
+    }
+
+    /*
+    Add the keys of other, which must all lie on one side of ours for this
+    to be a join. Interleaved key ranges are merged by union_with instead.
+    */
+    void join(const ESet &other) {
+        if (&other == this) return;
+        Index y = share(other);
+        if (!root || !y || cmp(p->get(findEnd(root, 1)).item->key, p->get(findEnd(y, 0)).item->key)) {
+            root = merge(root, y);
+        } else if (cmp(p->get(findEnd(y, 1)).item->key, p->get(findEnd(root, 0)).item->key)) {
+            root = merge(y, root);
+        } else root = unite(root, y, false);
+        version++;
+    }
+
+    // Erase every key in [l, r] and return how many there were.
+    size_t erase(const Key &l, const Key &r) {
+        if (cmp(r, l)) return 0;
+        Index a, b, c;
+        cut(root, l, false, a, b);
+        cut(b, r, true, b, c);
+        size_t cnt = p->info(b).size;
+        p->release(b);
+        root = merge(a, c);
+        version++;
+        return cnt;
+    }
+
+    // Move the keys in [l, r] out into a set of their own.
+    ESet extract(const Key &l, const Key &r) {
+        if (cmp(r, l)) return ESet(p, 0);
+        Index a, b, c;
+        cut(root, l, false, a, b);
+        cut(b, r, true, b, c);
+        root = merge(a, c);
+        version++;
+        return ESet(p, b);
     }
 
     size_t range(const Key &l, const Key &r) const {
-        return count_lower(r) - count_upper(l);
+        return range<Key>(l, r);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t range(const K &l, const K &r) const {
+        if (cmp(r, l)) return 0;
+        return count_between(l, r);
+    }
+
+    // The k-th smallest key, counting from 0, or end() if k >= size().
+    iterator nth(size_t k) const {
+        return iterator(findNth(k), this);
+    }
+
+    // Number of keys less than key.
+    size_t rank(const Key &key) const {
+        return count_upper(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    size_t rank(const K &key) const {
+        return count_upper(key);
     }
 
     iterator find(const Key& key) const {
         return iterator(nfind(key), this);
     }
 
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator find(const K &key) const {
+        return iterator(nfind(key), this);
+    }
+
     iterator lower_bound(const Key &key) const {
-        size_t x, y=0;
+        return lower_bound<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator lower_bound(const K &key) const {
+        Index x, y=0;
+        ESET_COUNT(descents);
         for (x=root; x; ) {
+            ESET_COUNT(visits);
             Node &n = p->get(x);
-            if (!cmp(*n.key, key)) {
+            if (!cmp(n.item->key, key)) {
                 y = x;
                 x = n.s[0];
             } else x = n.s[1];
@@ -366,10 +1057,17 @@ private:
     }
 
     iterator upper_bound(const Key &key) const {
-        size_t x, y=0;
+        return upper_bound<Key>(key);
+    }
+
+    template <class K, class = std::enable_if_t<ESetLookup<Compare, Key, K>::value>>
+    iterator upper_bound(const K &key) const {
+        Index x, y=0;
+        ESET_COUNT(descents);
         for (x=root; x; ) {
+            ESET_COUNT(visits);
             Node &n = p->get(x);
-            if (cmp(key, *n.key)) {
+            if (cmp(key, n.item->key)) {
                 y = x;
                 x = n.s[0];
             } else x = n.s[1];
@@ -393,4 +1091,12 @@ private:
 #endif
 };
 
-#endif
\ No newline at end of file
+} // namespace eset::treap
+
+#if !defined(ESET_NO_GLOBAL) && !defined(ESET_GLOBAL_DEFINED)
+#define ESET_GLOBAL_DEFINED
+template <typename Key, typename Compare = std::less<Key>>
+using ESet = eset::treap::ESet<Key, Compare>;
+#endif
+
+#endif
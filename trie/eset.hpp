@@ -0,0 +1,571 @@
+#ifndef ESET_TRIE_HPP
+#define ESET_TRIE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus > 201703L
+#include <compare>
+#endif
+
+#ifdef DEBUG
+#include <iostream>
+#include <string>
+#endif
+
+#include "../common/eset_common.hpp"
+
+namespace eset::trie {
+
+// Keys the trie can hold: integers ordered by std::less.
+template <class Key, class Compare>
+struct Applies : std::integral_constant<bool, std::is_integral<Key>::value && !std::is_same<Key, bool>::value && sizeof(Key) <= 8
+    && (std::is_same<Compare, std::less<Key>>::value || std::is_same<Compare, std::less<>>::value)> {};
+
+/*
+Trie of 64-way nodes over the bits of integer keys, in the manner of a van
+Emde Boas tree whose clusters are one machine word: a node branches on six
+bits of the key, and a 64-bit mask of the digits present is all it needs to
+find a successor or predecessor among its children, with one count of
+trailing or leading zeros. The last six bits are the bits of a leaf's mask,
+so a leaf holds up to 64 consecutive keys in one word.
+
+Levels where all keys agree are skipped, so every inner node has two
+children or more and a 64-bit key is at most 11 nodes down, however many
+keys there are. Nodes store only the children present, in digit order,
+right after the node in the same allocation, and the number of keys below
+them, for rank, nth and range. An inner node doubles its room for children
+when it runs out, up to 64; a leaf is 32 bytes.
+
+Keys are not stored one by one, so an iterator holds a copy of its key
+and *it returns it by value, as a const Key: unlike the other backends
+there is no reference into the set to take, and no operator->. An
+iterator stays usable after its key is erased, stepping from where that
+key was.
+*/
+template <class Key, class Compare = std::less<Key>>
+class ESet {
+    static_assert(Applies<Key, Compare>::value, "eset::trie::ESet takes integer keys ordered by std::less");
+
+private:
+    typedef std::uint64_t Bits;
+    typedef std::make_unsigned_t<Key> Unsigned;
+
+    // Signed keys have their sign bit flipped, so that the unsigned order is the order of the keys.
+    static constexpr Unsigned SIGN = std::is_signed<Key>::value ? Unsigned(Unsigned(1) << (sizeof(Key) * 8 - 1)) : 0;
+
+    static Bits encode(Key key) {
+        return Bits(Unsigned(Unsigned(key) ^ SIGN));
+    }
+
+    static Key decode(Bits u) {
+        return Key(Unsigned(Unsigned(u) ^ SIGN));
+    }
+
+    static constexpr Bits MAX = Bits(Unsigned(-1));
+
+    struct Node {
+        Bits prefix;    // the key bits above this node's digit, the rest zero
+        Bits mask;      // digits present: children, or the keys of a leaf
+        size_t size;    // keys below
+        int shift;      // lowest bit of the digit it branches on; 0 for a leaf
+        int cap;        // room for children after the node
+
+        bool leaf() const {
+            return !shift;
+        }
+
+        int count() const {
+            return __builtin_popcountll(mask);
+        }
+
+        // One per bit of mask, in order.
+        Node** child() {
+            return reinterpret_cast<Node**>(this + 1);
+        }
+
+        Node* const* child() const {
+            return reinterpret_cast<Node* const*>(this + 1);
+        }
+    };
+
+    Node *root;
+
+    static int digit(Bits u, int shift) {
+        return int(u >> shift & 63);
+    }
+
+    static Bits prefixOf(Bits u, int shift) {
+        return shift + 6 >= 64 ? 0 : u >> (shift + 6) << (shift + 6);
+    }
+
+    // Largest key the subtree of x could hold.
+    static Bits top(const Node *x) {
+        return x->shift + 6 >= 64 ? MAX : x->prefix | ((Bits(1) << (x->shift + 6)) - 1);
+    }
+
+    // Bits of mask strictly below d.
+    static Bits below(Bits mask, int d) {
+        return mask & ((Bits(1) << d) - 1);
+    }
+
+    // Bits of mask strictly above d.
+    static Bits above(Bits mask, int d) {
+        return d == 63 ? 0 : mask & (~Bits(0) << (d + 1));
+    }
+
+    static int lowest(Bits mask) {
+        return __builtin_ctzll(mask);
+    }
+
+    static int highest(Bits mask) {
+        return 63 - __builtin_clzll(mask);
+    }
+
+    static int slotOf(const Node *x, int d) {
+        return __builtin_popcountll(below(x->mask, d));
+    }
+
+    static Node* childAt(const Node *x, int d) {
+        return x->child()[slotOf(x, d)];
+    }
+
+    static Node* newNode(Bits prefix, int shift, Bits mask, size_t size, int cap) {
+        Node *x = static_cast<Node*>(::operator new(sizeof(Node) + cap * sizeof(Node*)));
+        return new (x) Node{prefix, mask, size, shift, cap};
+    }
+
+    static void freeNode(Node *x) {
+        ::operator delete(x);
+    }
+
+    static Node* newLeaf(Bits u) {
+        return newNode(u & ~Bits(63), 0, Bits(1) << (u & 63), 1, 0);
+    }
+
+    // Adds c under the inner node *x, moving *x to a bigger block when full.
+    static void addChild(Node *&x, Node *c) {
+        int n = x->count();
+        if (n == x->cap) {
+            Node *y = newNode(x->prefix, x->shift, x->mask, x->size, x->cap * 2);
+            std::copy(x->child(), x->child() + n, y->child());
+            freeNode(x);
+            x = y;
+        }
+        int d = digit(c->prefix, x->shift), i = slotOf(x, d);
+        Node **ch = x->child();
+        std::copy_backward(ch + i, ch + n, ch + n + 1);
+        ch[i] = c;
+        x->mask |= Bits(1) << d;
+    }
+
+    static void release(Node *x) {
+        for (int i = 0, n = x->count(); i < n && !x->leaf(); i++) release(x->child()[i]);
+        freeNode(x);
+    }
+
+    static Node* clone(const Node *x) {
+        if (x->leaf()) return newNode(x->prefix, 0, x->mask, x->size, 0);
+        int n = x->count(), cap = 4;
+        for (; cap < n; cap *= 2);
+        Node *y = newNode(x->prefix, x->shift, x->mask, x->size, cap);
+        for (int i = 0; i < n; i++) y->child()[i] = clone(x->child()[i]);
+        return y;
+    }
+
+    static Bits first(const Node *x) {
+        for (; !x->leaf(); x = x->child()[0]);
+        return x->prefix | lowest(x->mask);
+    }
+
+    static Bits last(const Node *x) {
+        for (; !x->leaf(); x = x->child()[x->count() - 1]);
+        return x->prefix | highest(x->mask);
+    }
+
+    // The smallest key of x not below u, if any.
+    static bool successor(const Node *x, Bits u, Bits &res) {
+        ESET_COUNT(visits);
+        if (u < x->prefix) {
+            res = first(x);
+            return true;
+        }
+        if (u > top(x)) return false;
+        int d = digit(u, x->shift);
+        if (x->leaf()) {
+            Bits m = x->mask & (~Bits(0) << d);
+            if (!m) return false;
+            res = x->prefix | lowest(m);
+            return true;
+        }
+        if (x->mask >> d & 1 && successor(childAt(x, d), u, res)) return true;
+        Bits m = above(x->mask, d);
+        if (!m) return false;
+        res = first(childAt(x, lowest(m)));
+        return true;
+    }
+
+    // The largest key of x not above u, if any.
+    static bool predecessor(const Node *x, Bits u, Bits &res) {
+        ESET_COUNT(visits);
+        if (u > top(x)) {
+            res = last(x);
+            return true;
+        }
+        if (u < x->prefix) return false;
+        int d = digit(u, x->shift);
+        if (x->leaf()) {
+            Bits m = x->mask & (d == 63 ? ~Bits(0) : (Bits(1) << (d + 1)) - 1);
+            if (!m) return false;
+            res = x->prefix | highest(m);
+            return true;
+        }
+        if (x->mask >> d & 1 && predecessor(childAt(x, d), u, res)) return true;
+        Bits m = below(x->mask, d);
+        if (!m) return false;
+        res = last(childAt(x, highest(m)));
+        return true;
+    }
+
+    bool findAbove(Bits u, Bits &res) const {
+        if (!root) return false;
+        ESET_COUNT(descents);
+        return successor(root, u, res);
+    }
+
+    bool findBelow(Bits u, Bits &res) const {
+        if (!root) return false;
+        ESET_COUNT(descents);
+        return predecessor(root, u, res);
+    }
+
+    bool contains(Bits u) const {
+        const Node *x = root;
+        ESET_COUNT(descents);
+        for (; x; x = childAt(x, digit(u, x->shift))) {
+            ESET_COUNT(visits);
+            if (prefixOf(u, x->shift) != x->prefix) return false;
+            if (x->leaf()) return x->mask >> (u & 63) & 1;
+            if (!(x->mask >> digit(u, x->shift) & 1)) return false;
+        }
+        return false;
+    }
+
+    // Number of keys below u.
+    size_t position(Bits u) const {
+        size_t k = 0;
+        ESET_COUNT(descents);
+        for (const Node *x = root; x; ) {
+            ESET_COUNT(visits);
+            if (u < x->prefix) break;
+            if (u > top(x)) {
+                k += x->size;
+                break;
+            }
+            int d = digit(u, x->shift);
+            if (x->leaf()) {
+                k += __builtin_popcountll(below(x->mask, d));
+                break;
+            }
+            int i = slotOf(x, d);
+            for (int j = 0; j < i; j++) k += x->child()[j]->size;
+            if (!(x->mask >> d & 1)) break;
+            x = x->child()[i];
+        }
+        return k;
+    }
+
+    // Number of keys not above u.
+    size_t positionAfter(Bits u) const {
+        return u == MAX ? size() : position(u + 1);
+    }
+
+    // The k-th smallest key, k < size().
+    Bits findNth(size_t k) const {
+        const Node *x = root;
+        ESET_COUNT(descents);
+        for (; !x->leaf(); ) {
+            ESET_COUNT(visits);
+            Node* const *c = x->child();
+            for (; k >= (*c)->size; c++) k -= (*c)->size;
+            x = *c;
+        }
+        ESET_COUNT(visits);
+        Bits m = x->mask;
+        for (; k--; ) m &= m - 1;
+        return x->prefix | lowest(m);
+    }
+
+    #ifdef DEBUG
+    void debug_print(const Node *x, int depth) const {
+        std::cerr << std::string(depth * 2, ' ') << "prefix: " << x->prefix << ", shift: " << x->shift << ", size: " << x->size << "\n";
+        for (int i = 0, n = x->count(); i < n && !x->leaf(); i++) debug_print(x->child()[i], depth + 1);
+    }
+    #endif
+
+public:
+    class iterator {
+        friend class ESet;
+    private:
+        const ESet *from;
+        Key key;
+        bool valid;     // false for end()
+
+        iterator(const ESet *from, bool valid, Bits u) : from{from}, key{decode(u)}, valid{valid} {}
+
+    public:
+        iterator() : from{nullptr}, key{}, valid{false} {}
+
+        // A copy, see above.
+        const Key operator*() const {
+            if (!valid) throw std::out_of_range("Out of range");
+            return key;
+        }
+
+        // O(1) within a leaf, at most a descent from the root otherwise.
+        iterator& operator++() {
+            if (!valid) return *this;
+            Bits u = encode(key), v;
+            valid = u != MAX && from->findAbove(u + 1, v);
+            if (valid) key = decode(v);
+            return *this;
+        }
+
+        iterator& operator--() {
+            if (!from) return *this;
+            Bits v;
+            if (!valid) {
+                if (!from->root) return *this;
+                key = decode(last(from->root));
+                valid = true;
+            } else if (encode(key) && from->findBelow(encode(key) - 1, v)) {
+                key = decode(v);
+            }
+            return *this;
+        }
+
+        // Moves k positions in O(log n), stopping at begin() or end().
+        iterator& operator+=(std::ptrdiff_t k) {
+            if (!from) return *this;
+            size_t i = valid ? from->position(encode(key)) : from->size();
+            if (k < 0) i = size_t(-k) < i ? i + k : 0;
+            else i += k;
+            valid = i < from->size();
+            if (valid) key = decode(from->findNth(i));
+            return *this;
+        }
+
+        iterator& operator-=(std::ptrdiff_t k) {
+            return *this += -k;
+        }
+
+        iterator operator+(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp += k;
+        }
+
+        iterator operator-(std::ptrdiff_t k) const {
+            iterator tmp = *this;
+            return tmp -= k;
+        }
+
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        iterator operator--(int) {
+            iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const iterator &other) const {
+            return from == other.from && valid == other.valid && (!valid || key == other.key);
+        }
+
+        bool operator!=(const iterator &other) const {
+            return !(*this == other);
+        }
+    };
+
+    ESet() : root{nullptr} {}
+
+    ~ESet() {
+        clear();
+    }
+
+    ESet(const ESet &other) : root{other.root ? clone(other.root) : nullptr} {}
+
+    ESet& operator=(const ESet &other) {
+        if (&other == this) return *this;
+        clear();
+        if (other.root) root = clone(other.root);
+        return *this;
+    }
+
+    ESet(ESet &&other) noexcept : root{other.root} {
+        other.root = nullptr;
+    }
+
+    ESet& operator=(ESet &&other) noexcept {
+        if (&other == this) return *this;
+        std::swap(root, other.root);
+        return *this;
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        Bits u = encode(Key(std::forward<Args>(args)...));
+        iterator it(this, true, u);
+        if (!root) {
+            root = newLeaf(u);
+            return std::make_pair(it, true);
+        }
+        Node *path[12];
+        int n = 0;
+        Node **x = &root;
+        ESET_COUNT(descents);
+        for (;;) {
+            ESET_COUNT(visits);
+            Node *y = *x;
+            if (prefixOf(u, y->shift) != y->prefix) {
+                // u leaves the keys of y at a higher digit: branch there.
+                int s = highest(u ^ y->prefix) / 6 * 6;
+                Node *z = newNode(prefixOf(u, s), s, 0, y->size + 1, 4);
+                addChild(z, y);
+                addChild(z, newLeaf(u));
+                *x = z;
+                break;
+            }
+            int d = digit(u, y->shift);
+            if (y->leaf()) {
+                if (y->mask >> d & 1) return std::make_pair(it, false);
+                y->mask |= Bits(1) << d;
+                y->size++;
+                break;
+            }
+            if (!(y->mask >> d & 1)) {
+                y->size++;
+                addChild(*x, newLeaf(u));
+                break;
+            }
+            path[n++] = y;
+            x = &y->child()[slotOf(y, d)];
+        }
+        for (int i = 0; i < n; i++) path[i]->size++;
+        return std::make_pair(it, true);
+    }
+
+    size_t erase(const Key &key) {
+        Bits u = encode(key);
+        Node *path[12];
+        Node **slot[12];
+        int n = 0;
+        Node **x = &root;
+        ESET_COUNT(descents);
+        for (;;) {
+            Node *y = *x;
+            if (!y || prefixOf(u, y->shift) != y->prefix) return 0;
+            ESET_COUNT(visits);
+            int d = digit(u, y->shift);
+            if (!(y->mask >> d & 1)) return 0;
+            if (y->leaf()) break;
+            path[n] = y;
+            slot[n++] = x;
+            x = &y->child()[slotOf(y, d)];
+        }
+        Node *y = *x;
+        y->mask &= ~(Bits(1) << (u & 63));
+        y->size--;
+        for (int i = 0; i < n; i++) path[i]->size--;
+        if (y->mask) return 1;
+        freeNode(y);
+        if (!n) {
+            root = nullptr;
+            return 1;
+        }
+        // Drop the empty leaf; a parent left with one child is replaced by it.
+        Node *p = path[n - 1];
+        int d = digit(u, p->shift);
+        Node **ch = p->child();
+        std::copy(ch + slotOf(p, d) + 1, ch + p->count(), ch + slotOf(p, d));
+        p->mask &= ~(Bits(1) << d);
+        if (p->count() == 1) {
+            *slot[n - 1] = ch[0];
+            freeNode(p);
+        }
+        return 1;
+    }
+
+    iterator find(const Key &key) const {
+        Bits u = encode(key);
+        return contains(u) ? iterator(this, true, u) : end();
+    }
+
+    void clear() noexcept {
+        if (root) release(root);
+        root = nullptr;
+    }
+
+    // Two counting descents, each at most 11 nodes.
+    size_t range(const Key &l, const Key &r) const {
+        if (r < l) return 0;
+        return positionAfter(encode(r)) - position(encode(l));
+    }
+
+    // The k-th smallest key, counting from 0, or end() if k >= size().
+    iterator nth(size_t k) const {
+        return k < size() ? iterator(this, true, findNth(k)) : end();
+    }
+
+    // Number of keys less than key.
+    size_t rank(const Key &key) const {
+        return position(encode(key));
+    }
+
+    size_t size() const noexcept {
+        return root ? root->size : 0;
+    }
+
+    iterator lower_bound(const Key &key) const {
+        Bits v;
+        return findAbove(encode(key), v) ? iterator(this, true, v) : end();
+    }
+
+    iterator upper_bound(const Key &key) const {
+        Bits u = encode(key), v;
+        return u != MAX && findAbove(u + 1, v) ? iterator(this, true, v) : end();
+    }
+
+    iterator begin() const noexcept {
+        return root ? iterator(this, true, first(root)) : end();
+    }
+
+    iterator end() const noexcept {
+        return iterator(this, false, 0);
+    }
+
+    #ifdef DEBUG
+    void debug_print() const {
+        if (root) debug_print(root, 0);
+    }
+    #endif
+};
+
+} // namespace eset::trie
+
+#if !defined(ESET_NO_GLOBAL) && !defined(ESET_GLOBAL_DEFINED)
+#define ESET_GLOBAL_DEFINED
+template <class Key, class Compare = std::less<Key>>
+using ESet = eset::trie::ESet<Key, Compare>;
+#endif
+
+#endif // ESET_TRIE_HPP